@@ -0,0 +1,349 @@
+// Timings of every stage of the engine on the bundled models, to track
+// regressions between releases.
+//
+// usage: engine_bench [--size WxH ...] [--warmup n] [--repeat n] [--threads n]
+//                     [--json file|-] [asset ...]
+//
+// Per model: OBJ parsing (the .mesh cache is bypassed) and the decoding of its
+// TGA maps from memory. Per model and resolution: vertex processing (transform,
+// culling, clipping and binning), rasterization of the FULL mode alone, and a
+// whole draw() in every RenderMode. Every benchmark runs --warmup times
+// untimed, then --repeat times; the median, 95th percentile and minimum are
+// reported, and written as JSON with --json.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <iterator>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "engine.hpp"
+
+namespace
+{
+    struct Asset
+    {
+        const char *name;
+        std::vector<std::string> objs;
+        // Prefix of the texture maps, empty for the models drawn untextured
+        std::string maps;
+    };
+
+    const Asset ASSETS[] = {
+        {"african_head", {"obj/african_head/african_head.obj"}, "obj/african_head/african_head"},
+        {"suzanne", {"obj/suzanne/suzanne.obj"}, ""},
+        {"boggie", {"obj/boggie/body.obj", "obj/boggie/eyes.obj"}, ""},
+        {"diablo3_pose", {"obj/diablo3/diablo3_pose.obj"}, ""},
+    };
+
+    const char *MAPS[] = {"_diffuse.tga", "_nm.tga", "_nm_tangent.tga", "_spec.tga"};
+
+    const struct
+    {
+        RenderMode mode;
+        const char *name;
+    } MODES[] = {
+        {RenderMode::WIREFRAME, "wireframe"},
+        {RenderMode::BACKFACE, "backface"},
+        {RenderMode::GOURAUD, "gouraud"},
+        {RenderMode::NORMALMAP, "normalmap"},
+        {RenderMode::TEXTURE, "texture"},
+        {RenderMode::FULL, "full"},
+        {RenderMode::FULL_TANGENT, "full_tangent"},
+    };
+
+    struct Options
+    {
+        std::vector<std::pair<int, int>> sizes;
+        int warmup = 2;
+        int repeat = 10;
+        int threads = 0;
+        std::string json;
+        std::vector<std::string> assets;
+    };
+
+    struct Result
+    {
+        std::string asset;
+        std::string benchmark;
+        int width = 0;
+        int height = 0;
+        // Milliseconds
+        double median;
+        double p95;
+        double min;
+        double mean;
+        int samples;
+    };
+
+    void usage()
+    {
+        std::cerr << "usage: engine_bench [--size WxH ...] [--warmup n] [--repeat n] [--threads n]\n"
+                  << "                    [--json file|-] [asset ...]\n"
+                  << "       assets: african_head, suzanne, boggie, diablo3_pose (all by default)\n";
+        exit(1);
+    }
+
+    Options parseOptions(int argc, char const *argv[])
+    {
+        Options options;
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (arg == "--size" && i + 1 < argc)
+            {
+                int width, height;
+                if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+                    usage();
+                options.sizes.push_back({width, height});
+            }
+            else if (arg == "--warmup" && i + 1 < argc)
+            {
+                options.warmup = std::max(0, std::stoi(argv[++i]));
+            }
+            else if (arg == "--repeat" && i + 1 < argc)
+            {
+                options.repeat = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--threads" && i + 1 < argc)
+            {
+                options.threads = std::stoi(argv[++i]);
+            }
+            else if (arg == "--json" && i + 1 < argc)
+            {
+                options.json = argv[++i];
+            }
+            else if (arg[0] != '-')
+            {
+                options.assets.push_back(arg);
+            }
+            else
+            {
+                usage();
+            }
+        }
+        if (options.sizes.empty())
+            options.sizes = {{800, 800}, {1920, 1080}, {3840, 2160}};
+        return options;
+    }
+
+    // Runs setup then the timed function, warmup times then repeat times
+    template <typename Setup, typename F>
+    Result measure(const Options &options, Setup setup, F f)
+    {
+        std::vector<double> samples;
+        for (int r = 0; r < options.warmup + options.repeat; r++)
+        {
+            setup();
+            auto start = std::chrono::steady_clock::now();
+            f();
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            if (r >= options.warmup)
+                samples.push_back(elapsed.count());
+        }
+        std::sort(samples.begin(), samples.end());
+        size_t n = samples.size();
+        Result result;
+        result.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+        // Nearest rank
+        result.p95 = samples[(size_t)std::ceil(0.95 * n) - 1];
+        result.min = samples[0];
+        double sum = 0;
+        for (double s : samples)
+        {
+            sum += s;
+        }
+        result.mean = sum / n;
+        result.samples = n;
+        return result;
+    }
+
+    template <typename F>
+    Result measure(const Options &options, F f)
+    {
+        return measure(options, [] {}, f);
+    }
+
+    void print(std::ostream &out, const Result &result)
+    {
+        std::string size = result.width ? std::to_string(result.width) + "x" + std::to_string(result.height) : "";
+        out << std::left << std::setw(14) << result.asset << std::setw(20) << result.benchmark << std::setw(11) << size
+            << std::right << std::setw(11) << result.median << std::setw(11) << result.p95 << std::setw(11) << result.min << std::endl;
+    }
+
+    // Threads the draws run on, as Engine::threadCount() picks them
+    int threadCount([[maybe_unused]] const Options &options)
+    {
+#ifdef _OPENMP
+        return options.threads > 0 ? options.threads : omp_get_max_threads();
+#else
+        return 1;
+#endif
+    }
+
+    bool writeJson(const std::string &filename, const Options &options, const std::vector<Result> &results)
+    {
+        std::ofstream file;
+        if (filename != "-")
+        {
+            file.open(filename);
+            if (!file.is_open())
+            {
+                std::cerr << "can't open file " << filename << "\n";
+                return false;
+            }
+        }
+        std::ostream &out = filename == "-" ? std::cout : file;
+        out << std::setprecision(6) << std::defaultfloat;
+        out << "{\n"
+            << "  \"threads\": " << threadCount(options) << ",\n"
+            << "  \"avx2\": " << (cpuHasAVX2() ? "true" : "false") << ",\n"
+            << "  \"warmup\": " << options.warmup << ",\n"
+            << "  \"repeat\": " << options.repeat << ",\n"
+            << "  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result &r = results[i];
+            out << "    {\"asset\": \"" << r.asset << "\", \"benchmark\": \"" << r.benchmark << "\", "
+                << "\"width\": " << r.width << ", \"height\": " << r.height << ", "
+                << "\"median_ms\": " << r.median << ", \"p95_ms\": " << r.p95 << ", "
+                << "\"min_ms\": " << r.min << ", \"mean_ms\": " << r.mean << ", \"samples\": " << r.samples << "}"
+                << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+        return out.good();
+    }
+
+    // Scene of the models of the asset, scaled and centered to fill the
+    // view of the camera like the african head does
+    Scene buildScene(const std::vector<std::shared_ptr<Model>> &models, std::shared_ptr<const Material> material)
+    {
+        vec3 lo = models[0]->bboxMin_, hi = models[0]->bboxMax_;
+        for (const auto &model : models)
+        {
+            for (int j = 0; j < 3; j++)
+            {
+                lo[j] = std::min(lo[j], model->bboxMin_[j]);
+                hi[j] = std::max(hi[j], model->bboxMax_[j]);
+            }
+        }
+        double extent = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+        double s = extent > 0 ? 2 / extent : 1;
+        mat4 transform = scale(vec3(s, s, s)) * translate((lo + hi) * -0.5);
+        Scene scene;
+        for (const auto &model : models)
+        {
+            scene.add(model, material, transform);
+        }
+        return scene;
+    }
+
+    void run(const Options &options, const Asset &asset, std::ostream &table, std::vector<Result> &results)
+    {
+        auto record = [&](Result result, const std::string &benchmark, int width, int height)
+        {
+            result.asset = asset.name;
+            result.benchmark = benchmark;
+            result.width = width;
+            result.height = height;
+            print(table, result);
+            results.push_back(result);
+        };
+
+        std::vector<std::shared_ptr<Model>> models;
+        record(measure(options, [&]
+                       {
+            models.clear();
+            for (const std::string &obj : asset.objs)
+            {
+                models.push_back(std::make_shared<Model>(obj, false));
+            } }),
+               "obj_parse", 0, 0);
+
+        std::shared_ptr<Material> material;
+        if (!asset.maps.empty())
+        {
+            std::vector<std::vector<unsigned char>> files;
+            for (const char *map : MAPS)
+            {
+                std::ifstream in(asset.maps + map, std::ios::binary);
+                files.emplace_back(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            }
+            TGAImage image;
+            record(measure(options, [&]
+                           {
+                for (const auto &file : files)
+                {
+                    image.read_tga(file.data(), file.size());
+                } }),
+                   "tga_decode", 0, 0);
+
+            material = std::make_shared<Material>();
+            material->set_diffusemap(asset.maps + MAPS[0]);
+            material->set_normalmap(asset.maps + MAPS[1]);
+            material->set_tangentmap(asset.maps + MAPS[2]);
+            material->set_specularmap(asset.maps + MAPS[3]);
+        }
+
+        Scene scene = buildScene(models, material);
+        for (auto [width, height] : options.sizes)
+        {
+            Camera camera(vec3(0, 0, 2.1), vec3(0, 0, 0), 90, 0.1, 1000, (double)width / height);
+            Engine engine(width, height, camera);
+            engine.scene = scene;
+            engine.setThreads(options.threads);
+            engine.setLight(vec3(0, 0, 1));
+            engine.M = rotate(vec3(0, 30, 0));
+
+            record(measure(options, [&]
+                           { engine.processVertices(RenderMode::FULL); }),
+                   "vertex", width, height);
+            record(measure(options, [&]
+                           {
+                engine.clear();
+                engine.processVertices(RenderMode::FULL); }, [&]
+                           { engine.rasterizeFaces(RenderMode::FULL); }),
+                   "raster", width, height);
+            for (const auto &mode : MODES)
+            {
+                record(measure(options, [&]
+                               { engine.clear(); }, [&]
+                               { engine.draw(mode.mode); }),
+                       std::string("draw_") + mode.name, width, height);
+            }
+        }
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    Options options = parseOptions(argc, argv);
+    std::vector<const Asset *> assets;
+    for (const Asset &asset : ASSETS)
+    {
+        if (options.assets.empty() || std::find(options.assets.begin(), options.assets.end(), asset.name) != options.assets.end())
+            assets.push_back(&asset);
+    }
+    if (assets.size() < std::max<size_t>(options.assets.size(), 1))
+        usage();
+
+    // The table goes to the standard error when the JSON is printed
+    std::ostream &table = options.json == "-" ? std::cerr : std::cout;
+    table << std::fixed << std::setprecision(3);
+    table << std::left << std::setw(14) << "asset" << std::setw(20) << "benchmark" << std::setw(11) << "size"
+              << std::right << std::setw(11) << "median ms" << std::setw(11) << "p95 ms" << std::setw(11) << "min ms" << std::endl;
+    std::vector<Result> results;
+    for (const Asset *asset : assets)
+    {
+        run(options, *asset, table, results);
+    }
+
+    if (!options.json.empty() && !writeJson(options.json, options, results))
+        return 1;
+    return 0;
+}
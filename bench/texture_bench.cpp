@@ -0,0 +1,189 @@
+// Sampling throughput and simulated cache misses of the texture layouts.
+//
+// usage: texture_bench [image.tga ...]
+//
+// Every image is sampled along the scanlines of a 512x512 screen square
+// mapped onto it at several rotations and scales, like the rasterizer walks
+// a textured triangle. The miss rate comes from a model of a 32 KiB 8-way
+// L1 data cache with 64-byte lines fed with the addresses of the nearest
+// texels, so it does not depend on the machine running the benchmark.
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#define _USE_MATH_DEFINES
+#include <cmath>
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "texture.hpp"
+
+namespace
+{
+    const int SCREEN = 512;
+    const int REPEATS = 5;
+
+    // Set-associative cache with LRU replacement
+    class CacheModel
+    {
+    public:
+        static const int LINE = 64;
+        static const int WAYS = 8;
+        static const int SETS = 32 * 1024 / LINE / WAYS;
+
+        CacheModel() : tags_(SETS * WAYS, UINT64_MAX), ages_(SETS * WAYS, 0) {}
+
+        void access(uintptr_t address)
+        {
+            uint64_t line = address / LINE;
+            int set = line % SETS;
+            uint64_t *tags = &tags_[set * WAYS];
+            uint64_t *ages = &ages_[set * WAYS];
+            accesses_++;
+            clock_++;
+            int victim = 0;
+            for (int i = 0; i < WAYS; i++)
+            {
+                if (tags[i] == line)
+                {
+                    ages[i] = clock_;
+                    return;
+                }
+                if (ages[i] < ages[victim])
+                    victim = i;
+            }
+            misses_++;
+            tags[victim] = line;
+            ages[victim] = clock_;
+        }
+
+        double missRate() const
+        {
+            return accesses_ ? (double)misses_ / accesses_ : 0;
+        }
+
+    private:
+        std::vector<uint64_t> tags_;
+        std::vector<uint64_t> ages_;
+        uint64_t clock_ = 0;
+        uint64_t accesses_ = 0;
+        uint64_t misses_ = 0;
+    };
+
+    struct Pattern
+    {
+        const char *name;
+        double angle;
+        // Texels per pixel
+        double scale;
+    };
+
+    const Pattern PATTERNS[] = {
+        {"rows 1:1", 0, 1},
+        {"diagonal 1:1", 45, 1},
+        {"columns 1:1", 90, 1},
+        {"columns 1:2", 90, 2},
+        {"diagonal 2:1", 45, 0.5},
+    };
+
+    // UVs of the screen square in scanline order
+    std::vector<vec2> scanlines(const Pattern &pattern, int width, int height)
+    {
+        double c = std::cos(pattern.angle * M_PI / 180);
+        double s = std::sin(pattern.angle * M_PI / 180);
+        std::vector<vec2> uvs;
+        uvs.reserve(SCREEN * SCREEN);
+        for (int y = 0; y < SCREEN; y++)
+        {
+            for (int x = 0; x < SCREEN; x++)
+            {
+                double dx = (x - SCREEN / 2) * pattern.scale;
+                double dy = (y - SCREEN / 2) * pattern.scale;
+                uvs.push_back(vec2(0.5 + (c * dx - s * dy) / width, 0.5 + (s * dx + c * dy) / height));
+            }
+        }
+        return uvs;
+    }
+
+    double missRate(const Texture &texture, const std::vector<vec2> &uvs)
+    {
+        CacheModel cache;
+        uintptr_t base = (uintptr_t)texture.data();
+        int w = texture.get_width();
+        int h = texture.get_height();
+        for (const vec2 &uv : uvs)
+        {
+            int x = uv.x * w;
+            int y = uv.y * h;
+            if (x >= 0 && y >= 0 && x < w && y < h)
+                cache.access(base + texelIndex(texture.layout(), w, x, y) * texture.get_bytespp());
+        }
+        return cache.missRate();
+    }
+
+    // Millions of samples per second, best of the repeats
+    double throughput(const Texture &texture, const std::vector<vec2> &uvs, TextureFilter filter, unsigned *checksum)
+    {
+        double best = 0;
+        for (int r = 0; r < REPEATS; r++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (const vec2 &uv : uvs)
+            {
+                *checksum += texture.sample(uv, 0, filter).val;
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::max(best, uvs.size() / elapsed.count() / 1e6);
+        }
+        return best;
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++)
+    {
+        files.push_back(argv[i]);
+    }
+    if (files.empty())
+    {
+        files = {"obj/african_head/african_head_diffuse.tga",
+                 "obj/african_head/african_head_nm.tga",
+                 "obj/african_head/african_head_spec.tga"};
+    }
+
+    unsigned checksum = 0;
+    std::cout << std::fixed;
+    for (const std::string &file : files)
+    {
+        Texture texture;
+        if (!texture.read_tga_file(file))
+            return 1;
+        std::cout << file << " (" << texture.get_width() << "x" << texture.get_height() << ", "
+                  << texture.get_bytespp() << " bytes per texel)\n";
+        std::cout << std::left << std::setw(14) << "pattern" << std::setw(11) << "layout" << std::right
+                  << std::setw(10) << "L1 miss" << std::setw(16) << "nearest Ms/s" << std::setw(17) << "bilinear Ms/s" << "\n";
+
+        for (const Pattern &pattern : PATTERNS)
+        {
+            std::vector<vec2> uvs = scanlines(pattern, texture.get_width(), texture.get_height());
+            for (TextureLayout layout : {TextureLayout::ROW_MAJOR, TextureLayout::MORTON})
+            {
+                texture.set_layout(layout);
+                std::cout << std::left << std::setw(14) << pattern.name << std::setw(11)
+                          << (layout == TextureLayout::ROW_MAJOR ? "row-major" : "morton") << std::right
+                          << std::setw(9) << std::setprecision(2) << missRate(texture, uvs) * 100 << "%"
+                          << std::setw(16) << std::setprecision(1) << throughput(texture, uvs, TextureFilter::NEAREST, &checksum)
+                          << std::setw(17) << throughput(texture, uvs, TextureFilter::BILINEAR, &checksum) << "\n";
+            }
+        }
+        std::cout << "\n";
+    }
+    // Keeps the samples from being optimized away
+    return checksum == 1 ? 2 : 0;
+}
@@ -0,0 +1,214 @@
+// Throughput of the TGA RLE codec against the previous one, which streamed
+// every pixel through std::istream::get / std::ostream::put.
+//
+// usage: tga_bench [image.tga ...]
+//
+// Every image is decoded from memory and encoded back to memory, so that disk
+// speed does not count. A 3840x2160 frame of the african head is rendered and
+// encoded too, like a 4K frame written by the engine. Every decoded image is
+// checked against the pixels it was encoded from.
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "engine.hpp"
+
+namespace
+{
+    const int REPEATS = 5;
+
+    // Previous decoder: one stream call per pixel
+    bool referenceDecode(std::istream &in, unsigned char *data, int width, int height, int bytespp)
+    {
+        unsigned long pixelcount = width * height;
+        unsigned long currentpixel = 0;
+        unsigned long currentbyte = 0;
+        TGAColor colorbuffer;
+        do
+        {
+            unsigned char chunkheader = in.get();
+            if (!in.good())
+                return false;
+            if (chunkheader < 128)
+            {
+                chunkheader++;
+                for (int i = 0; i < chunkheader; i++)
+                {
+                    in.read((char *)colorbuffer.raw, bytespp);
+                    if (!in.good())
+                        return false;
+                    for (int t = 0; t < bytespp; t++)
+                        data[currentbyte++] = colorbuffer.raw[t];
+                    if (++currentpixel > pixelcount)
+                        return false;
+                }
+            }
+            else
+            {
+                chunkheader -= 127;
+                in.read((char *)colorbuffer.raw, bytespp);
+                if (!in.good())
+                    return false;
+                for (int i = 0; i < chunkheader; i++)
+                {
+                    for (int t = 0; t < bytespp; t++)
+                        data[currentbyte++] = colorbuffer.raw[t];
+                    if (++currentpixel > pixelcount)
+                        return false;
+                }
+            }
+        } while (currentpixel < pixelcount);
+        return true;
+    }
+
+    // Previous encoder: serial, one stream call per packet
+    void referenceEncode(std::ostream &out, const unsigned char *data, int width, int height, int bytespp)
+    {
+        const unsigned char max_chunk_length = 128;
+        unsigned long npixels = width * height;
+        unsigned long curpix = 0;
+        while (curpix < npixels)
+        {
+            unsigned long chunkstart = curpix * bytespp;
+            unsigned long curbyte = curpix * bytespp;
+            unsigned char run_length = 1;
+            bool raw = true;
+            while (curpix + run_length < npixels && run_length < max_chunk_length)
+            {
+                bool succ_eq = true;
+                for (int t = 0; succ_eq && t < bytespp; t++)
+                {
+                    succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
+                }
+                curbyte += bytespp;
+                if (1 == run_length)
+                    raw = !succ_eq;
+                if (raw && succ_eq)
+                {
+                    run_length--;
+                    break;
+                }
+                if (!raw && !succ_eq)
+                    break;
+                run_length++;
+            }
+            curpix += run_length;
+            out.put(raw ? run_length - 1 : run_length + 127);
+            out.write((char *)(data + chunkstart), (raw ? run_length * bytespp : bytespp));
+        }
+    }
+
+    template <typename F>
+    double best(F f)
+    {
+        double seconds = 1e30;
+        for (int r = 0; r < REPEATS; r++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            f();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            seconds = std::min(seconds, elapsed.count());
+        }
+        return seconds;
+    }
+
+    bool samePixels(const TGAImage &a, const TGAImage &b)
+    {
+        size_t n = (size_t)a.get_width() * a.get_height() * a.get_bytespp();
+        return a.get_width() == b.get_width() && a.get_height() == b.get_height() && a.get_bytespp() == b.get_bytespp() &&
+               memcmp(a.buffer(), b.buffer(), n) == 0;
+    }
+
+    // Encodes and decodes the image with both codecs, false when a decoded
+    // image differs from the original
+    bool run(const std::string &name, const TGAImage &image)
+    {
+        int w = image.get_width(), h = image.get_height(), bpp = image.get_bytespp();
+        double megabytes = (double)w * h * bpp / 1e6;
+
+        std::string reference;
+        double referenceEncodeTime = best([&]
+                                          {
+            std::ostringstream out;
+            referenceEncode(out, image.buffer(), w, h, bpp);
+            reference = out.str(); });
+        std::vector<unsigned char> file;
+        double encodeTime = best([&]
+                                 { image.write_tga(file); });
+
+        // The previous decoder reads the packets that follow the header
+        std::vector<unsigned char> pixels((size_t)w * h * bpp);
+        bool ok = true;
+        double referenceDecodeTime = best([&]
+                                          {
+            std::istringstream in(reference);
+            ok = referenceDecode(in, pixels.data(), w, h, bpp) && ok; });
+        TGAImage decoded;
+        double decodeTime = best([&]
+                                 { ok = decoded.read_tga(file.data(), file.size()) && ok; });
+        ok = ok && samePixels(decoded, image) && memcmp(pixels.data(), image.buffer(), pixels.size()) == 0;
+        // The new packets read back with the previous decoder too
+        std::istringstream packets(std::string(file.begin() + sizeof(TGA_Header), file.end()));
+        ok = ok && referenceDecode(packets, pixels.data(), w, h, bpp) && memcmp(pixels.data(), image.buffer(), pixels.size()) == 0;
+
+        std::cout << std::left << std::setw(44) << name << std::right << std::setw(6) << w << "x" << std::setw(4) << h
+                  << std::setw(11) << std::setprecision(1) << reference.size() / 1e3 << std::setw(9) << (file.size() - 44) / 1e3
+                  << std::setw(11) << megabytes / referenceEncodeTime << std::setw(9) << megabytes / encodeTime
+                  << std::setw(11) << megabytes / referenceDecodeTime << std::setw(9) << megabytes / decodeTime
+                  << (ok ? "" : "  MISMATCH") << "\n";
+        return ok;
+    }
+
+    // Frame of the african head rendered like the engine does
+    TGAImage renderFrame(int width, int height)
+    {
+        Camera camera(vec3(0, 0, 2.1), vec3(0, 0, 0), 90, 0.1, 1000, (double)width / height);
+        auto model = std::make_shared<Model>("obj/african_head/african_head.obj");
+        auto material = std::make_shared<Material>();
+        material->set_diffusemap("obj/african_head/african_head_diffuse.tga");
+        material->set_normalmap("obj/african_head/african_head_nm.tga");
+        material->set_specularmap("obj/african_head/african_head_spec.tga");
+        Engine engine(width, height, camera);
+        engine.addInstance(model, material);
+        engine.setLight(vec3(0, 0, 1));
+        engine.M = rotate(vec3(0, 30, 0));
+        engine.draw(RenderMode::FULL);
+        return engine.frameBuffer;
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++)
+    {
+        files.push_back(argv[i]);
+    }
+    if (files.empty())
+    {
+        files = {"obj/african_head/african_head_diffuse.tga",
+                 "obj/african_head/african_head_nm.tga",
+                 "obj/african_head/african_head_nm_tangent.tga",
+                 "obj/african_head/african_head_spec.tga"};
+    }
+
+    std::cout << std::fixed;
+    std::cout << std::left << std::setw(44) << "image" << std::right << std::setw(11) << "size"
+              << std::setw(20) << "RLE kB (old, new)" << std::setw(20) << "encode MB/s" << std::setw(20) << "decode MB/s" << "\n";
+    bool ok = true;
+    for (const std::string &file : files)
+    {
+        TGAImage image;
+        if (!image.read_tga_file(file.c_str()))
+            return 1;
+        ok = run(file, image) && ok;
+    }
+    ok = run("3840x2160 frame", renderFrame(3840, 2160)) && ok;
+    return ok ? 0 : 1;
+}
@@ -1,9 +1,6 @@
 #!/bin/bash
-# This script will run 360 times the cpp executable with the input parameter corresponding to the number of the iteration
-for i in {0..359}
-do
-    ./build/engine $i
-done
+# Render the 360 frames of the turntable in a single process, the model and textures are loaded once
+./build/engine --frames 0:360:1 --axis y
 echo "TGA files generated"
 
 # Convert the output to png
@@ -14,10 +11,8 @@ echo "PNG files generated"
 rm out/*.tga
 echo "TGA files removed"
 
-# Create a gif
-# convert -delay 5 -loop 0 out/*.png out.gif
-# echo "GIF file generated"
+# Or stream the frames straight into a video encoder, without any temporary file
+# ./build/engine --frames 0:360:1 --axis y --format y4m | ffmpeg -i - out.mp4
 
-# Remove the png files
-# rm out/*.png
-# echo "PNG files removed"
\ No newline at end of file
+# Or assemble the turntable into an animated GIF, without any external tool
+# ./build/engine --frames 0:360:1 --axis y --format gif --output out.gif
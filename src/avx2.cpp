@@ -0,0 +1,422 @@
+#include <string.h>
+#include "avx2.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// Only the functions below are compiled for AVX2, the rest of the program
+// keeps running on any x86 CPU. FMA is left out on purpose: the depth and
+// UV interpolation must round exactly like the scalar path.
+#define AVX2 __attribute__((target("avx2")))
+
+bool cpuHasAVX2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+namespace
+{
+    // Edge values and coordinates further than this (in pixels) from the
+    // origin would overflow the exact int64 to double conversion below
+    const double MAX_COORD = 1 << 15;
+
+    // Natural logarithm of x > 0, Cephes polynomial (about 1 ulp)
+    AVX2 inline __m256 log_ps(__m256 x)
+    {
+        const __m256 one = _mm256_set1_ps(1.0f);
+        __m256i bits = _mm256_castps_si256(x);
+        __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+        // Mantissa in [0.5, 1)
+        __m256 m = _mm256_or_ps(_mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x807fffff))), _mm256_set1_ps(0.5f));
+
+        __m256 small = _mm256_cmp_ps(m, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+        e = _mm256_sub_ps(e, _mm256_and_ps(one, small));
+        m = _mm256_add_ps(_mm256_sub_ps(m, one), _mm256_and_ps(m, small));
+
+        __m256 z = _mm256_mul_ps(m, m);
+        __m256 y = _mm256_set1_ps(7.0376836292E-2f);
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(-1.1514610310E-1f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(1.1676998740E-1f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(-1.2420140846E-1f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(1.4249322787E-1f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(-1.6668057665E-1f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(2.0000714765E-1f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(-2.4999993993E-1f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, m), _mm256_set1_ps(3.3333331174E-1f));
+        y = _mm256_mul_ps(_mm256_mul_ps(y, m), z);
+
+        y = _mm256_add_ps(y, _mm256_mul_ps(e, _mm256_set1_ps(-2.12194440e-4f)));
+        y = _mm256_sub_ps(y, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+        return _mm256_add_ps(_mm256_add_ps(m, y), _mm256_mul_ps(e, _mm256_set1_ps(0.693359375f)));
+    }
+
+    // e^x, Cephes polynomial (about 1 ulp), flushes to ~0 below -88
+    AVX2 inline __m256 exp_ps(__m256 x)
+    {
+        x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+        x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+
+        __m256 fx = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _mm256_set1_ps(0.5f)));
+        x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(0.693359375f)));
+        x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(-2.12194440e-4f)));
+
+        __m256 z = _mm256_mul_ps(x, x);
+        __m256 y = _mm256_set1_ps(1.9875691500E-4f);
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.3981999507E-3f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(8.3334519073E-3f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(4.1665795894E-2f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.6666665459E-1f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(5.0000001201E-1f));
+        y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(y, z), x), _mm256_set1_ps(1.0f));
+
+        __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+        return _mm256_mul_ps(y, _mm256_castsi256_ps(pow2n));
+    }
+
+    // Exact conversion of int64 lanes in [-2^51, 2^51) to double
+    AVX2 inline __m256d int64ToDouble(__m256i v)
+    {
+        const __m256i magicBits = _mm256_set1_epi64x(0x4338000000000000);
+        const __m256d magic = _mm256_set1_pd(6755399441055744.0);
+        return _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(v, magicBits)), magic);
+    }
+
+    // 64-bit lane mask from the 4 low bits of a lane bitmask
+    AVX2 inline __m256i mask4(int bits)
+    {
+        const __m256i lanes = _mm256_set_epi64x(8, 4, 2, 1);
+        return _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_set1_epi64x(bits), lanes), lanes);
+    }
+
+    // 32-bit lane mask from an 8 lanes bitmask
+    AVX2 inline __m256i mask8(int bits)
+    {
+        const __m256i lanes = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+        return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), lanes), lanes);
+    }
+
+    // Lanes whose key passes the depth test: unless the stored key is closer
+    // or equal, like DepthBuffer::test
+    AVX2 inline __m256d depthPass(__m256d stored, __m256d key, bool reversed)
+    {
+        return reversed ? _mm256_cmp_pd(stored, key, _CMP_NGE_UQ) : _mm256_cmp_pd(stored, key, _CMP_NLE_UQ);
+    }
+
+    AVX2 inline __m256 depthPass(__m256 stored, __m256 key, bool reversed)
+    {
+        return reversed ? _mm256_cmp_ps(stored, key, _CMP_NGE_UQ) : _mm256_cmp_ps(stored, key, _CMP_NLE_UQ);
+    }
+
+    AVX2 inline int movemask64(__m256d lo, __m256d hi)
+    {
+        return _mm256_movemask_pd(lo) | (_mm256_movemask_pd(hi) << 4);
+    }
+
+    AVX2 inline __m256d interpolate(const double *a, __m256d b0, __m256d b1, __m256d b2)
+    {
+        __m256d r = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(a[0]), b0), _mm256_mul_pd(_mm256_set1_pd(a[1]), b1));
+        return _mm256_add_pd(r, _mm256_mul_pd(_mm256_set1_pd(a[2]), b2));
+    }
+
+    // Fetches 8 texels like TGAImage::get: texels outside the image or in
+    // masked lanes read as 0, and only the low bytespp bytes are set
+    AVX2 inline __m256i gather(const TextureView &t, __m256i x, __m256i y, int bits)
+    {
+        if (!t.data || !bits)
+            return _mm256_setzero_si256();
+
+        const __m256i minusOne = _mm256_set1_epi32(-1);
+        const __m256i width = _mm256_set1_epi32(t.width);
+        const __m256i height = _mm256_set1_epi32(t.height);
+        __m256i inside = _mm256_and_si256(mask8(bits), _mm256_and_si256(_mm256_cmpgt_epi32(x, minusOne), _mm256_cmpgt_epi32(y, minusOne)));
+        inside = _mm256_and_si256(inside, _mm256_and_si256(_mm256_cmpgt_epi32(width, x), _mm256_cmpgt_epi32(height, y)));
+
+        __m256i offset = _mm256_mullo_epi32(_mm256_add_epi32(x, _mm256_mullo_epi32(y, width)), _mm256_set1_epi32(t.bytespp));
+        // 4 bytes are read per texel, the last ones would overrun the image
+        int last = t.width * t.height * t.bytespp - 4;
+        __m256i safe = _mm256_and_si256(inside, _mm256_cmpgt_epi32(_mm256_set1_epi32(last + 1), offset));
+        __m256i texels = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)t.data, offset, safe, 1);
+
+        int tail = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(safe, inside)));
+        if (tail)
+        {
+            alignas(32) int offsets[8];
+            alignas(32) unsigned int values[8];
+            _mm256_store_si256((__m256i *)offsets, offset);
+            _mm256_store_si256((__m256i *)values, texels);
+            for (int k = 0; k < 8; k++)
+            {
+                if (tail & (1 << k))
+                {
+                    values[k] = 0;
+                    memcpy(&values[k], t.data + offsets[k], t.bytespp);
+                }
+            }
+            texels = _mm256_load_si256((const __m256i *)values);
+        }
+
+        if (t.bytespp < 4)
+        {
+            texels = _mm256_and_si256(texels, _mm256_set1_epi32((1u << (8 * t.bytespp)) - 1));
+        }
+        return texels;
+    }
+
+    // Fetches one component of 8 decoded normals like NormalMap::sample:
+    // texels outside the map or in masked lanes read as -1
+    AVX2 inline __m256 gather(const NormalView &t, __m256i x, __m256i y, int component, int bits)
+    {
+        const __m256 black = _mm256_set1_ps(-1.0f);
+        if (!t.data || !bits)
+            return black;
+
+        const __m256i minusOne = _mm256_set1_epi32(-1);
+        const __m256i width = _mm256_set1_epi32(t.width);
+        const __m256i height = _mm256_set1_epi32(t.height);
+        __m256i inside = _mm256_and_si256(mask8(bits), _mm256_and_si256(_mm256_cmpgt_epi32(x, minusOne), _mm256_cmpgt_epi32(y, minusOne)));
+        inside = _mm256_and_si256(inside, _mm256_and_si256(_mm256_cmpgt_epi32(width, x), _mm256_cmpgt_epi32(height, y)));
+        __m256i index = _mm256_mullo_epi32(_mm256_add_epi32(x, _mm256_mullo_epi32(y, width)), _mm256_set1_epi32(3));
+        return _mm256_mask_i32gather_ps(black, t.data + component, index, _mm256_castsi256_ps(inside), 4);
+    }
+
+    // Texel coordinates of the 8 UVs, truncated like the scalar samplers
+    template <typename View>
+    AVX2 inline void texel(const View &t, __m256d u0, __m256d u1, __m256d v0, __m256d v1, __m256i *x, __m256i *y)
+    {
+        __m256d w = _mm256_set1_pd(t.width);
+        __m256d h = _mm256_set1_pd(t.height);
+        *x = _mm256_set_m128i(_mm256_cvttpd_epi32(_mm256_mul_pd(u1, w)), _mm256_cvttpd_epi32(_mm256_mul_pd(u0, w)));
+        *y = _mm256_set_m128i(_mm256_cvttpd_epi32(_mm256_mul_pd(v1, h)), _mm256_cvttpd_epi32(_mm256_mul_pd(v0, h)));
+    }
+
+    // One 8-bit channel of the lanes 0-3 (half 0) or 4-7 (half 1)
+    AVX2 inline __m256d channel(__m256i texels, int shift, int half)
+    {
+        __m256i c = _mm256_and_si256(_mm256_srli_epi32(texels, shift), _mm256_set1_epi32(0xff));
+        return _mm256_cvtepi32_pd(half ? _mm256_extracti128_si256(c, 1) : _mm256_castsi256_si128(c));
+    }
+
+    // Channel scaled by k (never negative), then offset by the ambient term
+    // and clamped like lit() and FullShader::shade
+    AVX2 inline __m256i light(__m256i texels, int shift, const __m256d *k, __m256i ambient)
+    {
+        __m128i lo = _mm256_cvttpd_epi32(_mm256_mul_pd(channel(texels, shift, 0), k[0]));
+        __m128i hi = _mm256_cvttpd_epi32(_mm256_mul_pd(channel(texels, shift, 1), k[1]));
+        __m256i c = _mm256_set_m128i(hi, lo);
+        return _mm256_slli_epi32(_mm256_min_epi32(_mm256_add_epi32(c, ambient), _mm256_set1_epi32(255)), shift);
+    }
+}
+
+AVX2 bool drawTriangleFullAVX2(const FullShading &s, const Tile &tile)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        if (!(std::abs(s.screenPoints[i].x) < MAX_COORD && std::abs(s.screenPoints[i].y) < MAX_COORD))
+            return false;
+    }
+
+    TriangleSetup t;
+    if (!t.setup(s.screenPoints, tile))
+        return true;
+
+    double z[3], u[3], v[3];
+    for (int i = 0; i < 3; i++)
+    {
+        z[i] = s.screenPoints[i].z;
+        u[i] = s.uv[i].x;
+        v[i] = s.uv[i].y;
+    }
+
+    // Edge offsets of the lanes 0-3 and 4-7 from the first pixel of a block
+    __m256i laneLo[3], laneHi[3], bias[3];
+    for (int i = 0; i < 3; i++)
+    {
+        int64_t d = t.stepX[i];
+        laneLo[i] = _mm256_set_epi64x(3 * d, 2 * d, d, 0);
+        laneHi[i] = _mm256_set_epi64x(7 * d, 6 * d, 5 * d, 4 * d);
+        bias[i] = _mm256_set1_epi64x(t.bias[i]);
+    }
+    const __m256d invArea = _mm256_set1_pd(t.invArea);
+    const __m256i minusOne = _mm256_set1_epi64x(-1);
+
+    __m256d M[3][4];
+    __m256d l[3];
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            M[i][j] = _mm256_set1_pd(s.M[i][j]);
+        }
+        l[i] = _mm256_set1_pd(s.light[i]);
+    }
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d keyScale = _mm256_set1_pd(s.depthScale);
+    const __m256d keyOffset = _mm256_set1_pd(s.depthOffset);
+    const __m256i ambient = _mm256_set1_epi32(5);
+
+    int64_t row[3] = {t.edge[0] + t.bias[0], t.edge[1] + t.bias[1], t.edge[2] + t.bias[2]};
+    for (int y = t.minY; y <= t.maxY; y++)
+    {
+        int64_t w[3] = {row[0], row[1], row[2]};
+        for (int x = t.minX; x <= t.maxX; x += 8)
+        {
+            __m256i eLo[3], eHi[3];
+            for (int i = 0; i < 3; i++)
+            {
+                __m256i base = _mm256_set1_epi64x(w[i]);
+                eLo[i] = _mm256_add_epi64(base, laneLo[i]);
+                eHi[i] = _mm256_add_epi64(base, laneHi[i]);
+                w[i] += 8 * t.stepX[i];
+            }
+
+            // Coverage of the lanes still inside the bounding box
+            __m256i coverLo = _mm256_cmpgt_epi64(_mm256_or_si256(_mm256_or_si256(eLo[0], eLo[1]), eLo[2]), minusOne);
+            __m256i coverHi = _mm256_cmpgt_epi64(_mm256_or_si256(_mm256_or_si256(eHi[0], eHi[1]), eHi[2]), minusOne);
+            int bits = movemask64(_mm256_castsi256_pd(coverLo), _mm256_castsi256_pd(coverHi));
+            int count = t.maxX - x + 1;
+            if (count < 8)
+                bits &= (1 << count) - 1;
+            if (!bits)
+                continue;
+
+            __m256d bLo[3], bHi[3];
+            for (int i = 0; i < 3; i++)
+            {
+                bLo[i] = _mm256_mul_pd(int64ToDouble(_mm256_sub_epi64(eLo[i], bias[i])), invArea);
+                bHi[i] = _mm256_mul_pd(int64ToDouble(_mm256_sub_epi64(eHi[i], bias[i])), invArea);
+            }
+
+            // ZBuffer
+            size_t idx = s.frameOrigin + x + (size_t)y * s.frameWidth;
+            __m256d zLo = interpolate(z, bLo[0], bLo[1], bLo[2]);
+            __m256d zHi = interpolate(z, bHi[0], bHi[1], bHi[2]);
+            if (s.reversedZ)
+            {
+                zLo = _mm256_add_pd(_mm256_mul_pd(zLo, keyScale), keyOffset);
+                zHi = _mm256_add_pd(_mm256_mul_pd(zHi, keyScale), keyOffset);
+            }
+            [[maybe_unused]] int tested = bits;
+            if (s.zBuffer32)
+            {
+                float *zb = s.zBuffer32 + idx;
+                __m256 key = _mm256_set_m128(_mm256_cvtpd_ps(zHi), _mm256_cvtpd_ps(zLo));
+                __m256 old = _mm256_maskload_ps(zb, mask8(bits));
+                bits &= _mm256_movemask_ps(depthPass(old, key, s.reversedZ));
+                ENGINE_COUNT(s.stats->depthPassed, __builtin_popcount(bits));
+                ENGINE_COUNT(s.stats->depthFailed, __builtin_popcount(tested & ~bits));
+                if (!bits)
+                    continue;
+                _mm256_maskstore_ps(zb, mask8(bits), key);
+            }
+            else
+            {
+                double *zb = s.zBuffer + idx;
+                __m256d oldLo = _mm256_maskload_pd(zb, mask4(bits));
+                __m256d oldHi = _mm256_maskload_pd(zb + 4, mask4(bits >> 4));
+                bits &= movemask64(depthPass(oldLo, zLo, s.reversedZ), depthPass(oldHi, zHi, s.reversedZ));
+                ENGINE_COUNT(s.stats->depthPassed, __builtin_popcount(bits));
+                ENGINE_COUNT(s.stats->depthFailed, __builtin_popcount(tested & ~bits));
+                if (!bits)
+                    continue;
+                _mm256_maskstore_pd(zb, mask4(bits), zLo);
+                _mm256_maskstore_pd(zb + 4, mask4(bits >> 4), zHi);
+            }
+
+            // UV mapping
+            __m256d uLo = interpolate(u, bLo[0], bLo[1], bLo[2]);
+            __m256d uHi = interpolate(u, bHi[0], bHi[1], bHi[2]);
+            __m256d vLo = interpolate(v, bLo[0], bLo[1], bLo[2]);
+            __m256d vHi = interpolate(v, bHi[0], bHi[1], bHi[2]);
+            __m256i tx, ty;
+
+            // Normal mapping, the lighting is computed in double like the
+            // scalar path, only the specular power is evaluated in float
+            texel(s.normal, uLo, uHi, vLo, vHi, &tx, &ty);
+            __m256 nm[3];
+            for (int i = 0; i < 3; i++)
+            {
+                nm[i] = gather(s.normal, tx, ty, i, bits);
+            }
+            __m256d intensity[2], base[2];
+            for (int h = 0; h < 2; h++)
+            {
+                __m256d n[3];
+                for (int i = 0; i < 3; i++)
+                {
+                    n[i] = _mm256_cvtps_pd(h ? _mm256_extractf128_ps(nm[i], 1) : _mm256_castps256_ps128(nm[i]));
+                }
+                __m256d wn[3];
+                for (int i = 0; i < 3; i++)
+                {
+                    __m256d r = _mm256_add_pd(_mm256_mul_pd(M[i][0], n[0]), _mm256_mul_pd(M[i][1], n[1]));
+                    r = _mm256_add_pd(r, _mm256_mul_pd(M[i][2], n[2]));
+                    wn[i] = _mm256_add_pd(r, M[i][3]);
+                }
+                intensity[h] = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(wn[0], l[0]), _mm256_mul_pd(wn[1], l[1])), _mm256_mul_pd(wn[2], l[2]));
+
+                // Reflected light direction, only its normalized z is needed
+                __m256d r[3];
+                for (int i = 0; i < 3; i++)
+                {
+                    r[i] = _mm256_sub_pd(_mm256_mul_pd(_mm256_mul_pd(two, wn[i]), intensity[h]), l[i]);
+                }
+                __m256d len = _mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(r[0], r[0]), _mm256_mul_pd(r[1], r[1])), _mm256_mul_pd(r[2], r[2])));
+                base[h] = _mm256_max_pd(_mm256_mul_pd(_mm256_div_pd(one, len), r[2]), _mm256_setzero_pd());
+            }
+
+            // Specular mapping
+            texel(s.specular, uLo, uHi, vLo, vHi, &tx, &ty);
+            __m256i exponentBits = _mm256_and_si256(gather(s.specular, tx, ty, bits), _mm256_set1_epi32(0xff));
+            __m256 exponent = _mm256_cvtepi32_ps(exponentBits);
+            __m256 b = _mm256_set_m128(_mm256_cvtpd_ps(base[1]), _mm256_cvtpd_ps(base[0]));
+            __m256 specular = exp_ps(_mm256_mul_ps(exponent, log_ps(b)));
+            // pow(0, e) is 0 and pow(b, 0) is 1
+            specular = _mm256_andnot_ps(_mm256_cmp_ps(b, _mm256_setzero_ps(), _CMP_EQ_OQ), specular);
+            specular = _mm256_blendv_ps(specular, _mm256_set1_ps(1.0f), _mm256_cmp_ps(exponent, _mm256_setzero_ps(), _CMP_EQ_OQ));
+            __m256d k[2];
+            for (int h = 0; h < 2; h++)
+            {
+                __m256d sp = _mm256_cvtps_pd(h ? _mm256_extractf128_ps(specular, 1) : _mm256_castps256_ps128(specular));
+                k[h] = _mm256_max_pd(_mm256_add_pd(intensity[h], _mm256_mul_pd(_mm256_set1_pd(0.6), sp)), _mm256_setzero_pd());
+            }
+
+            // Texture mapping
+            texel(s.diffuse, uLo, uHi, vLo, vHi, &tx, &ty);
+            __m256i diffuse = gather(s.diffuse, tx, ty, bits);
+            __m256i color = _mm256_and_si256(diffuse, _mm256_set1_epi32(0xff000000));
+            color = _mm256_or_si256(color, light(diffuse, 0, k, ambient));
+            color = _mm256_or_si256(color, light(diffuse, 8, k, ambient));
+            color = _mm256_or_si256(color, light(diffuse, 16, k, ambient));
+
+            alignas(32) unsigned int pixels[8];
+            _mm256_store_si256((__m256i *)pixels, color);
+            unsigned char *out = s.frame + idx * s.frameBytespp;
+            for (int i = 0; i < 8; i++)
+            {
+                if (bits & (1 << i))
+                    memcpy(out + i * s.frameBytespp, &pixels[i], s.frameBytespp);
+            }
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            row[i] += t.stepY[i];
+        }
+    }
+    return true;
+}
+
+#else
+
+bool cpuHasAVX2()
+{
+    return false;
+}
+
+bool drawTriangleFullAVX2(const FullShading &, const Tile &)
+{
+    return false;
+}
+
+#endif
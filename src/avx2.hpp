@@ -0,0 +1,62 @@
+#pragma once
+
+#include "geometry.hpp"
+#include "rasterizer.hpp"
+#include "profiler.hpp"
+
+// Raw view of a texture for the SIMD samplers, data is NULL for a missing map
+struct TextureView
+{
+    const unsigned char *data;
+    int width;
+    int height;
+    int bytespp;
+};
+
+// Raw view of a decoded normal map: 3 floats per texel, data is NULL for a
+// missing map
+struct NormalView
+{
+    const float *data;
+    int width;
+    int height;
+};
+
+// Everything RenderMode::FULL needs to shade one triangle
+struct FullShading
+{
+    vec3 screenPoints[3];
+    vec2 uv[3];
+
+    TextureView diffuse;
+    NormalView normal;
+    TextureView specular;
+
+    // Normal matrix of the model, applied to the normals read from the normal map
+    mat4 M;
+    vec3 light;
+
+    // Storage of the depth buffer, only one of them is set. With reversed-Z
+    // the keys stored are z * depthScale + depthOffset, see DepthBuffer
+    double *zBuffer;
+    float *zBuffer32;
+    bool reversedZ;
+    double depthScale;
+    double depthOffset;
+    unsigned char *frame;
+    // Pixel (x, y) of the tile is at frameOrigin + x + y * frameWidth in the
+    // frame and depth buffers, see PixelLayout
+    size_t frameOrigin;
+    int frameWidth;
+    int frameBytespp;
+    // Depth test results of the tile, counted with ENGINE_PROFILE
+    FrameStats *stats;
+};
+
+// True when the CPU running the program supports AVX2
+bool cpuHasAVX2();
+
+// Shades the part of the triangle covering the tile 8 pixels at a time.
+// Returns false when the triangle is outside the range the SIMD path handles,
+// in which case nothing was drawn and the scalar path must be used.
+bool drawTriangleFullAVX2(const FullShading &s, const Tile &tile);
@@ -1,4 +1,6 @@
 #pragma once
+#include <algorithm>
+
 #include "geometry.hpp"
 struct Camera
 {
@@ -20,6 +22,15 @@ struct Camera
         update();
     }
 
+    void setPerspective(double a_fov, double a_near, double a_far, double a_aspect)
+    {
+        fov = a_fov;
+        near = a_near;
+        far = a_far;
+        aspect = a_aspect;
+        projectionDirty_ = true;
+    }
+
     void setView(vec3 a_pos, vec3 a_lookAt)
     {
         pos = a_pos;
@@ -27,14 +38,93 @@ struct Camera
         update();
     }
 
+    // Must be called after modifying the public fields directly so that the
+    // cached matrices are rebuilt on next access
     void update()
     {
         z = normalize(pos - lookAt);
         x = normalize(cross(vec3(0, 1, 0), z));
         y = normalize(cross(z, x));
+        viewDirty_ = true;
+        projectionDirty_ = true;
+    }
+
+    const mat4 &viewMatrix()
+    {
+        if (viewDirty_)
+        {
+            view_ = buildViewMatrix();
+            viewDirty_ = false;
+        }
+        return view_;
+    }
+
+    const mat4 &projectionMatrix()
+    {
+        if (projectionDirty_)
+        {
+            projection_ = buildProjectionMatrix();
+            projectionDirty_ = false;
+        }
+        return projection_;
+    }
+
+    // Extra divide by the distance of the camera to the origin along z
+    // applied after the projection, see perspectiveDivide()
+    mat4 perspectiveMatrix()
+    {
+        mat4 matrix = mat4::identity();
+        matrix[3][2] = -1 / pos.z;
+        return matrix;
+    }
+
+    // Near and far planes over the coordinates perspectiveMatrix() *
+    // projectionMatrix() produces, before the divide: a point is on the
+    // visible side of a plane when its dot product with it is positive.
+    // They are z + w >= 0 and w - z >= 0 before perspectiveMatrix()
+    vec4 nearPlane()
+    {
+        double k = -1 / pos.z;
+        return vec4(0, 0, 1 - k, 1);
+    }
+
+    vec4 farPlane()
+    {
+        double k = -1 / pos.z;
+        return vec4(0, 0, -1 - k, 1);
+    }
+
+    // Depth after perspectiveDivide() of the near and far planes: z / w spans
+    // [-1, 1] before perspectiveMatrix(), and z / (k z + w) after it. The far
+    // planes go to infinity when the camera is within 1 of the origin along
+    // z, their depth is then capped at 1 / MIN_DEPTH_SCALE
+    vec2 depthRange()
+    {
+        const double MIN_DEPTH_SCALE = 1e-3;
+        double k = -1 / pos.z;
+        return vec2(-1 / std::max(1 - k, MIN_DEPTH_SCALE), 1 / std::max(1 + k, MIN_DEPTH_SCALE));
+    }
+
+    vec3 perspectiveDivide(vec4 point)
+    {
+        // Same as multiplying by an identity matrix whose [3][2] is -1 / pos.z
+        double w = (-1 / pos.z) * point.z + point.w;
+
+        vec3 v;
+        v.x = point.x / w;
+        v.y = point.y / w;
+        v.z = point.z / w;
+
+        return v;
     }
 
-    mat4 viewMatrix()
+private:
+    mat4 view_;
+    mat4 projection_;
+    bool viewDirty_ = true;
+    bool projectionDirty_ = true;
+
+    mat4 buildViewMatrix()
     {
         mat4 translation = mat4::identity();
         translation[0][3] = -pos.x;
@@ -55,7 +145,7 @@ struct Camera
         return rotation * translation;
     }
 
-    mat4 projectionMatrix()
+    mat4 buildProjectionMatrix()
     {
         double fovRad = std::tan((fov * 0.5) * (M_PI / 180));
         mat4 matrix = mat4::identity();
@@ -67,28 +157,4 @@ struct Camera
         matrix[3][3] = 0;
         return matrix;
     }
-
-    vec3 perspectiveDivide(vec4 point)
-    {
-        mat4 matrix = mat4::identity();
-        matrix[3][2] = -1 / pos.z;
-        mat<4, 1> p;
-        p[0][0] = point.x;
-        p[1][0] = point.y;
-        p[2][0] = point.z;
-        p[3][0] = point.w;
-
-        mat<4, 1> result = matrix * p;
-
-        result[0][0] /= result[3][0];
-        result[1][0] /= result[3][0];
-        result[2][0] /= result[3][0];
-
-        vec3 v;
-        v.x = result[0][0];
-        v.y = result[1][0];
-        v.z = result[2][0];
-
-        return v;
-    }
 };
\ No newline at end of file
@@ -0,0 +1,368 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+
+#include "rasterizer.hpp"
+
+// Storage of the depth values
+enum class DepthFormat
+{
+    // Exact depth of the fragments, 8 bytes per pixel
+    FLOAT64,
+    FLOAT32,
+    // Fixed point over the depth range: 24 bits stored in 4 bytes, like D24
+    // with its unused stencil byte, and 16 bits in 2 bytes
+    UNORM24,
+    UNORM16
+};
+
+// Depth of every pixel. Fragments carry the depth z of their screen point,
+// smaller is closer, and pass the depth test when they are strictly closer
+// than the stored depth.
+//
+// setRange() gives the depths of the near and far planes, t = 0 and t = 1.
+// Float formats store z itself, or 1 - t with reversed-Z: far depths then land
+// near 0, where floats are dense. Fixed point formats quantize t, or 1 - t.
+// Either way comparisons stay exact on the stored keys.
+//
+// clear() only marks the blocks to clear, prepare() clears them when a region
+// is about to be drawn, while its depth is brought into the cache anyway.
+class DepthBuffer
+{
+public:
+    // Side in pixels of the blocks cleared at once, regions given to
+    // prepare() must be aligned on it to be cleared independently
+    static const int CLEAR_BLOCK = 8;
+
+    DepthBuffer() {}
+
+    DepthBuffer(int width, int height, DepthFormat format = DepthFormat::FLOAT64, bool reversed = false)
+    {
+        resize(width, height, format, reversed);
+    }
+
+    void resize(int width, int height, DepthFormat format, bool reversed)
+    {
+        if (width != width_ || height != height_)
+            layout_ = PixelLayout(FrameLayout::LINEAR, width, height, 1);
+        width_ = width;
+        height_ = height;
+        format_ = format;
+        reversed_ = reversed;
+        blocksX_ = (width + CLEAR_BLOCK - 1) / CLEAR_BLOCK;
+        int blocksY = (height + CLEAR_BLOCK - 1) / CLEAR_BLOCK;
+        size_t n = (size_t)width * height;
+        // Only the storage of the format is allocated
+        float64_.assign(format == DepthFormat::FLOAT64 ? n : 0, 0);
+        float32_.assign(format == DepthFormat::FLOAT32 ? n : 0, 0);
+        unorm32_.assign(format == DepthFormat::UNORM24 ? n : 0, 0);
+        unorm16_.assign(format == DepthFormat::UNORM16 ? n : 0, 0);
+        pending_.assign(blocksX_ * blocksY, 1);
+    }
+
+    // Depths of the near and far planes, the stored keys are only valid for
+    // the range they were written with
+    void setRange(double near, double far)
+    {
+        scale_ = 1 / (far - near);
+        offset_ = -near * scale_;
+    }
+
+    // Affine map from z to the keys of the float formats
+    double keyScale() const
+    {
+        return reversed_ ? -scale_ : 1;
+    }
+
+    double keyOffset() const
+    {
+        return reversed_ ? 1 - offset_ : 0;
+    }
+
+    void setFormat(DepthFormat format, bool reversed)
+    {
+        resize(width_, height_, format, reversed);
+    }
+
+    // Order of the depths in memory, the buffer is cleared
+    void setLayout(const PixelLayout &layout)
+    {
+        layout_ = layout;
+        clear();
+    }
+
+    const PixelLayout &layout() const
+    {
+        return layout_;
+    }
+
+    int get_width() const
+    {
+        return width_;
+    }
+
+    int get_height() const
+    {
+        return height_;
+    }
+
+    DepthFormat format() const
+    {
+        return format_;
+    }
+
+    bool reversed() const
+    {
+        return reversed_;
+    }
+
+    // Resets every pixel to the far value, lazily
+    void clear()
+    {
+        std::fill(pending_.begin(), pending_.end(), 1);
+    }
+
+    // Clears the blocks of the rectangle still waiting for it
+    void prepare(const Tile &rect)
+    {
+        for (int by = rect.minY / CLEAR_BLOCK; by <= rect.maxY / CLEAR_BLOCK; by++)
+        {
+            for (int bx = rect.minX / CLEAR_BLOCK; bx <= rect.maxX / CLEAR_BLOCK; bx++)
+            {
+                char &pending = pending_[bx + by * blocksX_];
+                if (!pending)
+                    continue;
+                Tile block = {bx * CLEAR_BLOCK, by * CLEAR_BLOCK, std::min((bx + 1) * CLEAR_BLOCK, width_) - 1,
+                              std::min((by + 1) * CLEAR_BLOCK, height_) - 1};
+                fill(block);
+                pending = 0;
+            }
+        }
+    }
+
+    // Clears every block still waiting for it, before reading the whole buffer
+    void prepare()
+    {
+        prepare(Tile{0, 0, width_ - 1, height_ - 1});
+    }
+
+    // Depth test of a fragment: stores its depth and returns true when it is
+    // closer than the depth stored at (x, y)
+    bool test(int x, int y, double z)
+    {
+        return test(layout_.index(x, y), z);
+    }
+
+    // Same at index i of layout(), which the caller already computed
+    bool test(size_t i, double z)
+    {
+        switch (format_)
+        {
+        case DepthFormat::FLOAT64:
+            return update(float64_[i], z * keyScale() + keyOffset());
+        case DepthFormat::FLOAT32:
+            return update(float32_[i], float(z * keyScale() + keyOffset()));
+        case DepthFormat::UNORM24:
+            return update(unorm32_[i], quantize<24, uint32_t>(z));
+        case DepthFormat::UNORM16:
+            return update(unorm16_[i], quantize<16, uint16_t>(z));
+        }
+        return false;
+    }
+
+    // Smallest depth no fragment in the rectangle can pass the test at or
+    // beyond, used by the hierarchical Z
+    double farthest(const Tile &rect) const
+    {
+        switch (format_)
+        {
+        case DepthFormat::FLOAT64:
+            return farthest(float64_, rect);
+        case DepthFormat::FLOAT32:
+            return farthest(float32_, rect);
+        case DepthFormat::UNORM24:
+            return farthest(unorm32_, rect);
+        case DepthFormat::UNORM16:
+            return farthest(unorm16_, rect);
+        }
+        return std::numeric_limits<double>::max();
+    }
+
+    // Number of pixels of the rectangle holding a fragment, prepared first
+    long covered(const Tile &rect) const
+    {
+        switch (format_)
+        {
+        case DepthFormat::FLOAT64:
+            return covered(float64_, rect);
+        case DepthFormat::FLOAT32:
+            return covered(float32_, rect);
+        case DepthFormat::UNORM24:
+            return covered(unorm32_, rect);
+        case DepthFormat::UNORM16:
+            return covered(unorm16_, rect);
+        }
+        return 0;
+    }
+
+    // Raw storage of the float formats for the SIMD paths, NULL otherwise.
+    // Depths are ordered by layout()
+    double *float64()
+    {
+        return float64_.empty() ? NULL : float64_.data();
+    }
+
+    float *float32()
+    {
+        return float32_.empty() ? NULL : float32_.data();
+    }
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    int blocksX_ = 0;
+    DepthFormat format_ = DepthFormat::FLOAT64;
+    bool reversed_ = false;
+    PixelLayout layout_;
+    // t = z * scale_ + offset_, [-1, 1] until setRange() is called
+    double scale_ = 0.5;
+    double offset_ = 0.5;
+    std::vector<double> float64_;
+    std::vector<float> float32_;
+    std::vector<uint32_t> unorm32_;
+    std::vector<uint16_t> unorm16_;
+    // Blocks cleared by clear() but not by prepare() yet
+    std::vector<char> pending_;
+
+    // Keys grow with the depth, and shrink with reversed-Z
+    template <typename T>
+    bool update(T &stored, T key)
+    {
+        if (reversed_ ? stored >= key : stored <= key)
+            return false;
+        stored = key;
+        return true;
+    }
+
+    template <int bits, typename T>
+    T quantize(double z) const
+    {
+        const double max = (1u << bits) - 1;
+        double t = std::clamp(z * scale_ + offset_, 0.0, 1.0);
+        T q = T(t * max + 0.5);
+        return reversed_ ? T(max - q) : q;
+    }
+
+    // Depth of a key, the inverse of the encoding of test()
+    double depth(double key) const
+    {
+        return (key - keyOffset()) / keyScale();
+    }
+
+    double depth(float key) const
+    {
+        return depth(double(key));
+    }
+
+    template <typename T>
+    double depth(T q) const
+    {
+        const double max = (T(1) << (sizeof(T) == 2 ? 16 : 24)) - 1;
+        return ((reversed_ ? max - q : q) / max - offset_) / scale_;
+    }
+
+    // Key of the cleared pixels
+    template <typename T>
+    T farKey() const
+    {
+        if constexpr (std::is_floating_point_v<T>)
+            return reversed_ ? 0 : std::numeric_limits<T>::max();
+        else
+            return reversed_ ? 0 : T((1u << (sizeof(T) == 2 ? 16 : 24)) - 1);
+    }
+
+    template <typename T>
+    void fill(const Tile &rect)
+    {
+        T far = farKey<T>();
+        std::vector<T> &data = storage<T>();
+        // Rectangles never straddle two tiles
+        TileAddress address = layout_.address(rect.minX, rect.minY);
+        for (int y = rect.minY; y <= rect.maxY; y++)
+        {
+            std::fill(&data[address.index(rect.minX, y)], &data[address.index(rect.maxX, y)] + 1, far);
+        }
+    }
+
+    template <typename T>
+    long covered(const std::vector<T> &data, const Tile &rect) const
+    {
+        T far = farKey<T>();
+        TileAddress address = layout_.address(rect.minX, rect.minY);
+        long n = 0;
+        for (int y = rect.minY; y <= rect.maxY; y++)
+        {
+            const T *row = &data[address.index(rect.minX, y)];
+            for (int x = 0; x <= rect.maxX - rect.minX; x++)
+            {
+                n += row[x] != far;
+            }
+        }
+        return n;
+    }
+
+    void fill(const Tile &rect)
+    {
+        switch (format_)
+        {
+        case DepthFormat::FLOAT64:
+            fill<double>(rect);
+            break;
+        case DepthFormat::FLOAT32:
+            fill<float>(rect);
+            break;
+        case DepthFormat::UNORM24:
+            fill<uint32_t>(rect);
+            break;
+        case DepthFormat::UNORM16:
+            fill<uint16_t>(rect);
+            break;
+        }
+    }
+
+    template <typename T>
+    std::vector<T> &storage()
+    {
+        if constexpr (std::is_same_v<T, double>)
+            return float64_;
+        else if constexpr (std::is_same_v<T, float>)
+            return float32_;
+        else if constexpr (std::is_same_v<T, uint32_t>)
+            return unorm32_;
+        else
+            return unorm16_;
+    }
+
+    template <typename T>
+    double farthest(const std::vector<T> &data, const Tile &rect) const
+    {
+        // Farthest key first, converted once
+        TileAddress address = layout_.address(rect.minX, rect.minY);
+        T key = data[address.index(rect.minX, rect.minY)];
+        for (int y = rect.minY; y <= rect.maxY; y++)
+        {
+            for (int x = rect.minX; x <= rect.maxX; x++)
+            {
+                T k = data[address.index(x, y)];
+                key = reversed_ ? std::min(key, k) : std::max(key, k);
+            }
+        }
+        // The far value of the float formats stands for no fragment at all
+        if (std::is_floating_point_v<T> && !reversed_ && key == std::numeric_limits<T>::max())
+            return std::numeric_limits<double>::max();
+        return depth(key);
+    }
+};
@@ -2,45 +2,169 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <limits>
+#include <type_traits>
+#include <cstring>
+#include <filesystem>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "geometry.hpp"
 #include "tgaimage.hpp"
 #include "model.hpp"
+#include "material.hpp"
+#include "scene.hpp"
 #include "camera.hpp"
+#include "rasterizer.hpp"
+#include "avx2.hpp"
+#include "hiz.hpp"
+#include "profiler.hpp"
+#include "shader.hpp"
 
 enum class RenderMode
 {
     WIREFRAME,
+    // Wireframe of the front faces only, whatever Engine::cull
     BACKFACE,
     GOURAUD,
     NORMALMAP,
     TEXTURE,
-    FULL
+    FULL,
+    // FULL with the tangent-space normal map
+    FULL_TANGENT
+};
+
+// Faces dropped by the cull stage, by their orientation on screen
+enum class CullMode
+{
+    NONE,
+    BACK,
+    FRONT
+};
+
+// Order of the corners of the faces facing the camera, on screen with y up
+enum class Winding
+{
+    COUNTER_CLOCKWISE,
+    CLOCKWISE
 };
 
 struct Engine
 {
+    // Side in pixels of the square screen tiles faces are binned into
+    static constexpr int TILE_SIZE = 64;
+    static_assert(TILE_SIZE % DepthBuffer::CLEAR_BLOCK == 0, "tiles clear whole depth blocks");
+
+    // In the tiled layout its pixels are only in rows once resolve() was
+    // called, which save() does
     TGAImage frameBuffer;
-    Model model;
+    // Instances drawn in one pass. Their models and materials can be shared
+    // between engines, several frames can be rendered at once
+    Scene scene;
+    // Transformation matrix applied to the whole scene
+    mat4 M = mat4::identity();
     Camera camera;
-    vec3 light_dir_;
+    vec3 light_dir_ = vec3(0, 0, 0);
+
+    // Only reset through clear(), which keeps the hierarchical Z in sync, and
+    // reformatted through setDepthFormat()
+    DepthBuffer depthBuffer;
+
+    // Number of threads used to rasterize tiles, 0 lets OpenMP decide
+    int threads = 0;
+
+    // Shade RenderMode::FULL 8 pixels at a time when the CPU supports AVX2
+    // (nearest filtering of row-major textures only)
+    bool simd = true;
+
+    // Filtering of the texture maps, the mip level is chosen per triangle
+    TextureFilter filter = TextureFilter::NEAREST;
+
+    // Rasterize the depth, face and barycentric coordinates of every pixel
+    // first, then shade each visible pixel exactly once
+    bool visibilityBuffer = false;
+
+    // Faces dropped before rasterization in every mode, and the winding of
+    // the front faces
+    CullMode cull = CullMode::BACK;
+    Winding frontFace = Winding::COUNTER_CLOCKWISE;
+
+    // Skip faces and 8x8 blocks of pixels hidden behind what was already drawn
+    bool hierarchicalZ = true;
 
-    double *zBuffer;
+    // Counters of the last frame drawn
+    FrameStats stats;
+    // Timeline the draws, their stages and tiles are recorded into when the
+    // engine is built with ENGINE_PROFILE, none if NULL
+    Profiler *profiler = NULL;
 
     Engine(int width, int height, Camera camera) : camera(camera)
     {
         frameBuffer = TGAImage(width, height, TGAImage::RGB);
-        zBuffer = new double[width * height];
-        for (int i = 0; i < width * height; i++)
-        {
-            zBuffer[i] = std::numeric_limits<double>::max();
-        }
+        depthBuffer.resize(width, height, DepthFormat::FLOAT64, false);
+        hiZ_.resize(width, height);
+        pixelLayout_ = PixelLayout(FrameLayout::LINEAR, width, height, TILE_SIZE);
+        clear();
+    }
+
+    void addInstance(std::shared_ptr<const Model> model, std::shared_ptr<const Material> material, const mat4 &transform = mat4::identity())
+    {
+        scene.add(model, material, transform);
+    }
+
+    // Resets the frame and depth buffers to render a new frame
+    void clear()
+    {
+        frameBuffer.clear();
+        depthBuffer.clear();
+        hiZ_.clear();
+        frameBlack_ = true;
+    }
+
+    // Changes the storage of the depth buffer, which is cleared
+    void setDepthFormat(DepthFormat format, bool reversed = false)
+    {
+        depthBuffer.setFormat(format, reversed);
+        hiZ_.clear();
+    }
+
+    // Order of the pixels of the frame and depth buffers while tiles are
+    // drawn. The frame keeps its pixels, the depth buffer is cleared
+    void setFrameLayout(FrameLayout layout)
+    {
+        resolve();
+        pixelLayout_ = PixelLayout(layout, frameBuffer.get_width(), frameBuffer.get_height(), TILE_SIZE);
+        depthBuffer.setLayout(pixelLayout_);
+        hiZ_.clear();
     }
 
-    void addModel(const std::string filename)
+    FrameLayout frameLayout() const
     {
-        // models.push_back(Model(filename));
-        model = Model(filename);
+        return pixelLayout_.layout();
+    }
+
+    // Puts the pixels of frameBuffer back in rows after tiled draws
+    void resolve()
+    {
+        setFrameTiled(false);
+    }
+
+    void setThreads(int n)
+    {
+        threads = n;
+    }
+
+    void setCulling(CullMode a_cull, Winding a_frontFace = Winding::COUNTER_CLOCKWISE)
+    {
+        cull = a_cull;
+        frontFace = a_frontFace;
+    }
+
+    void setFilter(TextureFilter a_filter)
+    {
+        filter = a_filter;
     }
 
     void setLight(vec3 light_dir)
@@ -50,280 +174,816 @@ struct Engine
 
     void draw(RenderMode render = RenderMode::FULL)
     {
-        for (int i = 0; i < model.nfaces(); i++)
-        {
-            std::vector<int> face = model.face(i);
-            std::vector<int> faceNormal = model.faceNormal(i);
-            std::vector<int> faceTexture = model.faceTexture(i);
-
-            vec3 modelPoints[3];
-            vec3 modelNormals[3];
-            vec3 modelTextures[3];
+        ENGINE_EVENT(profiler, "draw");
+        processVertices(render);
+        rasterizeFaces(render);
+    }
 
-            for (int j = 0; j < 3; j++)
-            {
-                modelPoints[j] = model.vert(face[j]);
-                modelNormals[j] = model.normal(faceNormal[j]);
-                modelTextures[j] = model.texture(faceTexture[j]);
-            }
+    // Draws the faces of the scene with a shader of the caller, depth tested
+    // and culled like the built-in modes. Its vertex stage, if any, places
+    // the vertices instead of the camera matrices
+    template <Shader S>
+    void draw(const S &shader)
+    {
+        ENGINE_EVENT(profiler, "draw");
+        processVertices(cull, shaderTangents<S>(), true, shader);
+        rasterizeFaces(shader);
+    }
 
-            // Convert to homogeneous coordinates
-            vec4 worldTextures[3];
-            for (int j = 0; j < 3; j++)
-            {
-                worldTextures[j] = vec4(modelTextures[j].x, modelTextures[j].y, modelTextures[j].z, 1);
-            }
+    // First half of draw(): transforms the vertices of the scene, culls and
+    // clips its faces, and bins them into the screen tiles
+    void processVertices(RenderMode render = RenderMode::FULL)
+    {
+        bool lines = render == RenderMode::WIREFRAME || render == RenderMode::BACKFACE;
+        processVertices(render == RenderMode::BACKFACE ? CullMode::BACK : cull, render == RenderMode::FULL_TANGENT, !lines, nullptr);
+    }
 
-            // Apply transformation matrix to world coordinates
-            vec4 worldPoints[3];
-            vec4 worldNormals[3];
-            for (int j = 0; j < 3; j++)
-            {
-                worldPoints[j] = model.M * vec4(modelPoints[j].x, modelPoints[j].y, modelPoints[j].z, 1);
-                worldNormals[j] = model.M * vec4(modelNormals[j].x, modelNormals[j].y, modelNormals[j].z, 1);
-            }
+    // Second half of draw(): draws the faces processVertices() kept, in the
+    // mode it was given. The shader of the mode is chosen once per draw
+    void rasterizeFaces(RenderMode render = RenderMode::FULL)
+    {
+        switch (render)
+        {
+        case RenderMode::WIREFRAME:
+        case RenderMode::BACKFACE:
+            drawLines();
+            break;
+        case RenderMode::GOURAUD:
+            rasterizeFaces(GouraudShader(light_dir_));
+            break;
+        case RenderMode::NORMALMAP:
+            rasterizeFaces(NormalMapShader(light_dir_, filter));
+            break;
+        case RenderMode::TEXTURE:
+            rasterizeFaces(TextureShader(light_dir_, filter));
+            break;
+        case RenderMode::FULL:
+            rasterizeFaces(FullShader(light_dir_, filter));
+            break;
+        case RenderMode::FULL_TANGENT:
+            rasterizeFaces(FullTangentShader(light_dir_, filter));
+            break;
+        }
+    }
 
-            // Apply camera view matrix
-            vec4 cameraPoints[3];
-            for (int j = 0; j < 3; j++)
-            {
-                cameraPoints[j] = camera.viewMatrix() * worldPoints[j];
-            }
+    // Shades the faces processVertices() kept. The rasterizer is instantiated
+    // for each shader type, with no mode left to test per fragment
+    template <Shader S>
+    void rasterizeFaces(const S &shader)
+    {
+        setFrameTiled(pixelLayout_.layout() == FrameLayout::TILED);
+        frameBlack_ = false;
+        frame_ = frameBuffer.view<TGAImage::RGB>();
 
-            // Apply camera projection matrix
-            vec4 projectedPoints[3];
-            for (int j = 0; j < 3; j++)
-            {
-                projectedPoints[j] = camera.projectionMatrix() * cameraPoints[j];
-            }
+        if (visibilityBuffer)
+        {
+            visibleFaces_.resize(frameBuffer.get_width() * frameBuffer.get_height());
+            visibleBarycentrics_.resize(frameBuffer.get_width() * frameBuffer.get_height());
+        }
 
-            // Perspective divide
-            vec3 screenPoints[3];
-            for (int j = 0; j < 3; j++)
+        // Each tile owns its slice of frameBuffer and depthBuffer, and keeps the
+        // faces in submission order, so the output matches a serial render
+        ENGINE_STAGE(stats, Stage::RASTER, profiler);
+        int tilesX = (frameBuffer.get_width() + TILE_SIZE - 1) / TILE_SIZE;
+        int ntiles = bins_.size();
+        tileStats_.assign(ntiles, FrameStats());
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threadCount())
+        for (int t = 0; t < ntiles; t++)
+        {
+            ENGINE_EVENT(profiler, "tile");
+            Tile tile;
+            tile.minX = (t % tilesX) * TILE_SIZE;
+            tile.minY = (t / tilesX) * TILE_SIZE;
+            tile.maxX = std::min(tile.minX + TILE_SIZE, frameBuffer.get_width()) - 1;
+            tile.maxY = std::min(tile.minY + TILE_SIZE, frameBuffer.get_height()) - 1;
+            depthBuffer.prepare(tile);
+            // The shader keeps the state of the face being drawn
+            S tileShader = shader;
+            if (visibilityBuffer)
             {
-                screenPoints[j] = camera.perspectiveDivide(projectedPoints[j]);
+                clearVisibility(tile);
+                for (int i : bins_[t])
+                {
+                    drawVisibility(i, tile);
+                }
+                shadeVisibility(tileShader, tile);
             }
-
-            // Convert to screen coordinates
-            for (int j = 0; j < 3; j++)
+            else
             {
-                screenPoints[j].x = (screenPoints[j].x + 1) * frameBuffer.get_width() / 2;
-                screenPoints[j].y = (screenPoints[j].y + 1) * frameBuffer.get_height() / 2;
+                for (int i : bins_[t])
+                {
+                    drawTriangle(i, tileShader, tile);
+                }
             }
-            // Draw triangle
-            if (render == RenderMode::WIREFRAME)
-                drawWireframe(screenPoints);
-            // else if (render == RenderMode::BACKFACE)
-            //     drawTriangle(screenPoints, worldNormals);
-            else if (render == RenderMode::GOURAUD)
-                drawTriangleGS(screenPoints, worldNormals);
-            else if (render == RenderMode::NORMALMAP)
-                drawTriangleNM(screenPoints, worldTextures);
-            else if (render == RenderMode::TEXTURE)
-                drawTriangleT(screenPoints, worldNormals, worldTextures);
-            else if (render == RenderMode::FULL)
-                drawTriangleFull(screenPoints, worldTextures);
+            ENGINE_COUNT(tileStats_[t].coveredPixels, depthBuffer.covered(tile));
         }
+        for (const FrameStats &tileStats : tileStats_)
+        {
+            stats += tileStats;
+        }
+        // Every fragment passing the depth test is shaded, unless deferred
+        if (!visibilityBuffer)
+            ENGINE_COUNT(stats.shadedFragments, stats.depthPassed);
+        ENGINE_COUNT(stats.textureSamples, stats.shadedFragments * shaderTextureSamples<S>());
     }
 
     void save(std::string filename)
     {
         // Create out folder if it doesn't exist
         std::filesystem::create_directory("out");
+        resolve();
         frameBuffer.flip_vertically();
         std::string out_file = "out/" + filename;
         frameBuffer.write_tga_file(out_file.c_str());
     }
 
 private:
-    /* Fonctionne */
-    void drawTriangleT(vec3 *screenPoints, vec4 *worldNormals, vec4 *worldTextures)
+    // Per-frame state of an instance: its world and normal matrices, and
+    // where its vertices, normals, tangents and faces start in the
+    // post-transform buffers and in the face ids
+    struct InstanceData
     {
-        // Boundig box
-        int minX, minY, maxX, maxY;
-        boundingBox(screenPoints, &minX, &minY, &maxX, &maxY);
+        const Model *model;
+        const Material *material;
+        mat4 world;
+        mat4 normal;
+        int vertices, normals, tangents, faces;
+    };
+    std::vector<InstanceData> instances_;
+    // Used by the instances without a material, all its maps are missing
+    Material noMaterial_;
+    // Faces of all the instances, the ids of the clipped triangles start there
+    int nfaces_ = 0;
 
-        for (int x = minX; x <= maxX; x++)
+    // Post-transform buffers of all the instances one after the other, each
+    // indexed like Model::vertices_, Model::normals_ and Model::tangents_
+    std::vector<vec4> clipVertices_;
+    std::vector<vec3> screenVertices_;
+    // Planes of clipPlanes_ each vertex is outside of
+    std::vector<unsigned short> outcodes_;
+    std::vector<vec4> worldNormals_;
+    std::vector<vec3> worldTangents_;
+    std::vector<vec3> worldBitangents_;
+
+    // The vertex stage of the shader transforms the positions if it has one,
+    // nullptr for the matrices alone
+    template <typename S>
+    void processVertices(CullMode mode, bool tangents, bool binned, const S &shader)
+    {
+        stats = FrameStats();
+        vec2 range = camera.depthRange();
+        depthBuffer.setRange(range.x, range.y);
         {
-            for (int y = minY; y <= maxY; y++)
-            {
-                TGAColor p_color = TGAColor(255, 255, 255, 255);
-                vec3 p = vec3(x, y, 0);
-                vec3 bc = barycentric(screenPoints[0], screenPoints[1], screenPoints[2], p);
-                if (bc.x < 0 || bc.y < 0 || bc.z < 0)
-                    continue;
+            ENGINE_STAGE(stats, Stage::TRANSFORM, profiler);
+            transformVertices(tangents, shader);
+        }
+        stats.submittedFaces = nfaces_;
+        {
+            ENGINE_STAGE(stats, Stage::CULL, profiler);
+            cullFaces(mode);
+        }
+        if (binned)
+        {
+            ENGINE_STAGE(stats, Stage::BIN, profiler);
+            binFaces();
+        }
+    }
 
-                // ZBuffer
-                p.z = screenPoints[0].z * bc.x + screenPoints[1].z * bc.y + screenPoints[2].z * bc.z;
-                int idx = x + y * frameBuffer.get_width();
-                if (zBuffer[idx] <= p.z)
-                    continue;
+    // Lines are not clipped to tiles, draw them in submission order
+    void drawLines()
+    {
+        setFrameTiled(false);
+        frameBlack_ = false;
+        ENGINE_STAGE(stats, Stage::RASTER, profiler);
+        for (int i : faces_)
+        {
+            vec3 screenPoints[3];
+            fetchScreenPoints(i, screenPoints);
+            drawWireframe(screenPoints);
+        }
+    }
 
-                zBuffer[idx] = p.z;
+    // Vertex stage: every vertex and normal of every instance is transformed
+    // exactly once per frame, whatever the number of faces sharing it
+    template <typename S>
+    void transformVertices(bool tangents, [[maybe_unused]] const S &shader)
+    {
+        const mat4 viewProjection = camera.perspectiveMatrix() * camera.projectionMatrix() * camera.viewMatrix();
+        viewport_ = mat4f(viewportMatrix());
+        setClipPlanes();
 
-                // Goroud shading
-                vec3 normal = normalize(vec3(worldNormals[0].x * bc.x + worldNormals[1].x * bc.y + worldNormals[2].x * bc.z,
-                                             worldNormals[0].y * bc.x + worldNormals[1].y * bc.y + worldNormals[2].y * bc.z,
-                                             worldNormals[0].z * bc.x + worldNormals[1].z * bc.y + worldNormals[2].z * bc.z));
+        instances_.clear();
+        int nverts = 0, nnormals = 0, ntangents = 0;
+        nfaces_ = 0;
+        for (const Instance &instance : scene.instances)
+        {
+            const Model &model = *instance.model;
+            const Material *material = instance.material ? instance.material.get() : &noMaterial_;
+            mat4 world = M * instance.transform;
+            instances_.push_back(InstanceData{&model, material, world, normalMatrix(world), nverts, nnormals, ntangents, nfaces_});
+            nverts += model.nverts();
+            nnormals += model.nnormals();
+            // Tangents are only transformed for the shaders using them
+            ntangents += tangents ? model.tangents_.size() : 0;
+            nfaces_ += model.nfaces();
+        }
+        clipVertices_.resize(nverts);
+        screenVertices_.resize(nverts);
+        outcodes_.resize(nverts);
+        worldNormals_.resize(nnormals);
+        worldTangents_.resize(ntangents);
+        worldBitangents_.resize(ntangents);
 
-                // UV mapping
-                vec2 uv = vec2(worldTextures[0].x * bc.x + worldTextures[1].x * bc.y + worldTextures[2].x * bc.z,
-                               worldTextures[0].y * bc.x + worldTextures[1].y * bc.y + worldTextures[2].y * bc.z);
-                double intensity = dot(normal, light_dir_);
+        for (const InstanceData &instance : instances_)
+        {
+            const Model &model = *instance.model;
+            // The fixed vertex stage runs in float with the SSE matrix product
+            const mat4f mvp = mat4f(viewProjection * instance.world);
+            const mat4f world = mat4f(instance.world);
+            const mat4f normal = mat4f(instance.normal);
 
-                // Texture mapping
-                p_color = model.diffuse(uv);
+            for (int i = 0; i < model.nverts(); i++)
+            {
+                vec3 v = model.vert(i);
+                vec4f clip;
+                if constexpr (VertexShader<S>)
+                    clip = vec4f(shader.vertex(v, instance.world, viewProjection));
+                else
+                    clip = mvp * vec4f(v.x, v.y, v.z, 1);
+                int k = instance.vertices + i;
+                clipVertices_[k] = vec4(clip);
+                outcodes_[k] = outcode(clipVertices_[k]);
+                screenVertices_[k] = screenPoint(clip);
+            }
 
-                p_color.r *= intensity;
-                p_color.g *= intensity;
-                p_color.b *= intensity;
+            for (int i = 0; i < model.nnormals(); i++)
+            {
+                vec3 n = model.normal(i);
+                worldNormals_[instance.normals + i] = vec4(normal * vec4f(n.x, n.y, n.z, 0));
+            }
 
-                frameBuffer.set(x, y, p_color);
+            // Tangents are directions, the translation does not apply
+            if (!tangents)
+                continue;
+            for (int i = 0; i < (int)model.tangents_.size(); i++)
+            {
+                vec3 t = model.tangent(i);
+                vec3 b = model.bitangent(i);
+                vec4f wt = world * vec4f(t.x, t.y, t.z, 0);
+                vec4f wb = world * vec4f(b.x, b.y, b.z, 0);
+                worldTangents_[instance.tangents + i] = vec3(wt.x, wt.y, wt.z);
+                worldBitangents_[instance.tangents + i] = vec3(wb.x, wb.y, wb.z);
             }
         }
     }
 
-    /* Fonctionne */
-    void drawTriangleGS(vec3 *screenPoints, vec4 *worldNormals)
+    // Index in instances_ of the instance a face id (below nfaces_) belongs to
+    int instanceOf(int i) const
     {
-        // Boundig box
-        int minX, minY, maxX, maxY;
-        boundingBox(screenPoints, &minX, &minY, &maxX, &maxY);
+        auto it = std::upper_bound(instances_.begin(), instances_.end(), i, [](int i, const InstanceData &instance)
+        {
+            return i < instance.faces;
+        });
+        return it - instances_.begin() - 1;
+    }
 
-        for (int x = minX; x <= maxX; x++)
+    // Clip-space planes, a vertex outside of plane i has bit i of its outcode set
+    enum ClipPlane
+    {
+        CLIP_LEFT,
+        CLIP_RIGHT,
+        CLIP_BOTTOM,
+        CLIP_TOP,
+        CLIP_NEAR,
+        CLIP_FAR,
+        // Side planes moved far enough out that the pixel coordinates of the
+        // vertices inside stay within TriangleSetup::GUARD_BAND
+        GUARD_LEFT,
+        GUARD_RIGHT,
+        GUARD_BOTTOM,
+        GUARD_TOP,
+        CLIP_PLANES
+    };
+    // Faces entirely outside of one of these planes are culled
+    static const unsigned FRUSTUM_PLANES = (1 << (CLIP_FAR + 1)) - 1;
+    // Faces crossing one of these planes are clipped against it, the others
+    // are left to the rasterizer which only walks pixels of the screen
+    static const unsigned CLIPPED_PLANES = 1 << CLIP_NEAR | 1 << GUARD_LEFT | 1 << GUARD_RIGHT | 1 << GUARD_BOTTOM | 1 << GUARD_TOP;
+
+    vec4 clipPlanes_[CLIP_PLANES];
+    mat4f viewport_;
+
+    void setClipPlanes()
+    {
+        // In normalized device coordinates
+        double guard = TriangleSetup::GUARD_BAND / (2 * std::max(frameBuffer.get_width(), frameBuffer.get_height()));
+        clipPlanes_[CLIP_LEFT] = vec4(1, 0, 0, 1);
+        clipPlanes_[CLIP_RIGHT] = vec4(-1, 0, 0, 1);
+        clipPlanes_[CLIP_BOTTOM] = vec4(0, 1, 0, 1);
+        clipPlanes_[CLIP_TOP] = vec4(0, -1, 0, 1);
+        clipPlanes_[CLIP_NEAR] = camera.nearPlane();
+        clipPlanes_[CLIP_FAR] = camera.farPlane();
+        clipPlanes_[GUARD_LEFT] = vec4(1, 0, 0, guard);
+        clipPlanes_[GUARD_RIGHT] = vec4(-1, 0, 0, guard);
+        clipPlanes_[GUARD_BOTTOM] = vec4(0, 1, 0, guard);
+        clipPlanes_[GUARD_TOP] = vec4(0, -1, 0, guard);
+    }
+
+    unsigned outcode(const vec4 &clip) const
+    {
+        unsigned code = 0;
+        for (int i = 0; i < CLIP_PLANES; i++)
         {
-            for (int y = minY; y <= maxY; y++)
-            {
-                TGAColor p_color = TGAColor(255, 255, 255, 255);
-                vec3 p = vec3(x, y, 0);
-                vec3 bc = barycentric(screenPoints[0], screenPoints[1], screenPoints[2], p);
-                if (bc.x < 0 || bc.y < 0 || bc.z < 0)
-                    continue;
+            if (dot(clipPlanes_[i], clip) < 0)
+                code |= 1 << i;
+        }
+        return code;
+    }
 
-                // ZBuffer
-                p.z = screenPoints[0].z * bc.x + screenPoints[1].z * bc.y + screenPoints[2].z * bc.z;
-                int idx = x + y * frameBuffer.get_width();
-                if (zBuffer[idx] <= p.z)
-                    continue;
+    vec3 screenPoint(const vec4f &clip) const
+    {
+        vec4f ndc = vec4f(clip.x / clip.w, clip.y / clip.w, clip.z / clip.w, 1);
+        vec4f screen = viewport_ * ndc;
+        return vec3(screen.x, screen.y, screen.z);
+    }
 
-                zBuffer[idx] = p.z;
+    // Faces overlapping each screen tile, in submission order
+    std::vector<std::vector<int>> bins_;
+    // Counters of every tile, summed into stats at the end of the frame
+    std::vector<FrameStats> tileStats_;
 
-                // Goroud shading
-                vec3 normal = normalize(vec3(worldNormals[0].x * bc.x + worldNormals[1].x * bc.y + worldNormals[2].x * bc.z,
-                                             worldNormals[0].y * bc.x + worldNormals[1].y * bc.y + worldNormals[2].y * bc.z,
-                                             worldNormals[0].z * bc.x + worldNormals[1].z * bc.y + worldNormals[2].z * bc.z));
-                double intensity = dot(normal, light_dir_);
+    HierarchicalZ hiZ_;
 
-                p_color.r *= intensity;
-                p_color.g *= intensity;
-                p_color.b *= intensity;
+    // Pixels of frameBuffer written by the fragments, which are always inside
+    // the tile being drawn, ordered by pixelLayout_
+    TGAView<TGAPixel<TGAImage::RGB>> frame_;
+    PixelLayout pixelLayout_;
+    // True while the pixels of frameBuffer are in tiles. A cleared frame is
+    // black in both layouts, nothing needs to move
+    bool frameTiled_ = false;
+    bool frameBlack_ = false;
+
+    void setFrameTiled(bool tiled)
+    {
+        if (tiled != frameTiled_ && !frameBlack_)
+            relayout(tiled);
+        frameTiled_ = tiled;
+    }
 
-                frameBuffer.set(x, y, p_color);
+    // Moves the pixels of frameBuffer between rows and tiles, a tile row at a
+    // time
+    void relayout(bool tiled)
+    {
+        ENGINE_STAGE(stats, Stage::RESOLVE, profiler);
+        int width = frameBuffer.get_width();
+        int height = frameBuffer.get_height();
+        int bpp = frameBuffer.get_bytespp();
+        PixelLayout tiles(FrameLayout::TILED, width, height, TILE_SIZE);
+        relayoutBuffer_.resize((size_t)width * height * bpp);
+        unsigned char *rows = tiled ? frameBuffer.buffer() : relayoutBuffer_.data();
+        unsigned char *tileRows = tiled ? relayoutBuffer_.data() : frameBuffer.buffer();
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x += TILE_SIZE)
+            {
+                size_t n = (size_t)std::min(TILE_SIZE, width - x) * bpp;
+                unsigned char *row = rows + ((size_t)y * width + x) * bpp;
+                unsigned char *tileRow = tileRows + tiles.index(x, y) * bpp;
+                if (tiled)
+                    memcpy(tileRow, row, n);
+                else
+                    memcpy(row, tileRow, n);
             }
         }
+        memcpy(frameBuffer.buffer(), relayoutBuffer_.data(), relayoutBuffer_.size());
     }
+    std::vector<unsigned char> relayoutBuffer_;
 
-    /* Fonctionne */
-    void drawTriangleFull(vec3 *screenPoints, vec4 *worldTextures)
+    // Depth test of a fragment, counted in the stats of its tile
+    bool depthTest(size_t idx, double z, [[maybe_unused]] FrameStats &counters)
     {
-        // Boundig box
-        int minX, minY, maxX, maxY;
-        boundingBox(screenPoints, &minX, &minY, &maxX, &maxY);
+        bool passed = depthBuffer.test(idx, z);
+        ENGINE_COUNT(passed ? counters.depthPassed : counters.depthFailed, 1);
+        return passed;
+    }
 
-        for (int x = minX; x <= maxX; x++)
+    FrameStats &tileStats(const Tile &tile)
+    {
+        int tilesX = (frameBuffer.get_width() + TILE_SIZE - 1) / TILE_SIZE;
+        return tileStats_[tile.minX / TILE_SIZE + tile.minY / TILE_SIZE * tilesX];
+    }
+
+    // Hierarchical Z test of a whole face. Returns false when it is hidden in
+    // the tile, otherwise sets box to its bounding box in the tile and nearest
+    // to a lower bound of the depth of its fragments
+    bool hiZVisible(vec3 *screenPoints, const Tile &tile, Tile *box, double *nearest)
+    {
+        boundingBox(screenPoints, tile, &box->minX, &box->minY, &box->maxX, &box->maxY);
+        if (box->minX > box->maxX || box->minY > box->maxY)
+            return false;
+        // Interpolated depths may round slightly below the smallest vertex depth
+        double z = std::min(screenPoints[0].z, std::min(screenPoints[1].z, screenPoints[2].z));
+        *nearest = z - 1e-9 * (1 + std::abs(z));
+        if (hierarchicalZ && hiZ_.occluded(depthBuffer, *box, *nearest))
         {
-            for (int y = minY; y <= maxY; y++)
-            {
-                TGAColor p_color = TGAColor(255, 255, 255, 255);
-                vec3 p = vec3(x, y, 0);
-                vec3 bc = barycentric(screenPoints[0], screenPoints[1], screenPoints[2], p);
-                if (bc.x < 0 || bc.y < 0 || bc.z < 0)
-                    continue;
+            tileStats(tile).hiZFaces++;
+            return false;
+        }
+        return true;
+    }
 
-                // ZBuffer
-                p.z = screenPoints[0].z * bc.x + screenPoints[1].z * bc.y + screenPoints[2].z * bc.z;
-                int idx = x + y * frameBuffer.get_width();
-                if (zBuffer[idx] <= p.z)
-                    continue;
+    // rasterize for the depth-tested modes: faces and blocks of pixels hidden
+    // behind the pixels already drawn are skipped
+    template <typename Fragment>
+    void rasterizeDepth(vec3 *screenPoints, const Tile &tile, Fragment &&fragment)
+    {
+        Tile box;
+        double nearest;
+        if (!hiZVisible(screenPoints, tile, &box, &nearest))
+            return;
+        if (!hierarchicalZ)
+        {
+            rasterize(screenPoints, tile, fragment);
+            return;
+        }
 
-                zBuffer[idx] = p.z;
+        FrameStats &counters = tileStats(tile);
+        rasterizeBlocks(screenPoints, tile, HierarchicalZ::BLOCK, [&](const Tile &block)
+        {
+            if (!hiZ_.occluded(depthBuffer, block, nearest))
+                return true;
+            counters.hiZBlocks++;
+            return false;
+        }, fragment);
+        hiZ_.touch(box);
+    }
 
-                // UV mapping
-                vec2 uv = vec2(worldTextures[0].x * bc.x + worldTextures[1].x * bc.y + worldTextures[2].x * bc.z,
-                               worldTextures[0].y * bc.x + worldTextures[1].y * bc.y + worldTextures[2].y * bc.z);
-                vec3 normal = model.normalmap(uv);
-                vec4 homogeneous_normal = vec4(normal.x, normal.y, normal.z, 1);
-                vec4 world_normal = model.M * homogeneous_normal;
-                normal = vec3(world_normal.x, world_normal.y, world_normal.z);
+    int threadCount()
+    {
+#ifdef _OPENMP
+        return threads > 0 ? threads : omp_get_max_threads();
+#else
+        return 1;
+#endif
+    }
 
-                double intensity = dot(normal, light_dir_);
+    void binFaces()
+    {
+        int width = frameBuffer.get_width();
+        int height = frameBuffer.get_height();
+        int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+        Tile screen = {0, 0, width - 1, height - 1};
 
-                // Specular mapping
-                vec3 r = normalize(2 * normal * dot(normal, light_dir_) - light_dir_);
-                double specular = pow(std::max(r.z, 0.0), model.specular(uv));
+        bins_.resize(tilesX * tilesY);
+        for (std::vector<int> &bin : bins_)
+        {
+            bin.clear();
+        }
 
-                // Texture mapping
-                p_color = model.diffuse(uv);
+        for (int i : faces_)
+        {
+            vec3 screenPoints[3];
+            fetchScreenPoints(i, screenPoints);
 
-                p_color.r *= (intensity + 0.6 * specular);
-                p_color.g *= (intensity + 0.6 * specular);
-                p_color.b *= (intensity + 0.6 * specular);
+            int minX, minY, maxX, maxY;
+            boundingBox(screenPoints, screen, &minX, &minY, &maxX, &maxY);
+            if (minX > maxX || minY > maxY)
+                continue;
 
-                int ambiant = 5;
+            for (int ty = minY / TILE_SIZE; ty <= maxY / TILE_SIZE; ty++)
+            {
+                for (int tx = minX / TILE_SIZE; tx <= maxX / TILE_SIZE; tx++)
+                {
+                    bins_[tx + ty * tilesX].push_back(i);
+                }
+            }
+        }
+    }
 
-                p_color.r = std::min(255, std::max(0, int(p_color.r + ambiant)));
-                p_color.g = std::min(255, std::max(0, int(p_color.g + ambiant)));
-                p_color.b = std::min(255, std::max(0, int(p_color.b + ambiant)));
+    void fetchFace(int i, Face &f)
+    {
+        if (i >= nfaces_)
+        {
+            f = clippedFaces_[i - nfaces_];
+            return;
+        }
+        f.instance = instanceOf(i);
+        const InstanceData &instance = instances_[f.instance];
+        f.material = instance.material;
+        f.normal = &instance.normal;
+        const Model &model = *instance.model;
+        const int *face = model.face(i - instance.faces);
+        const int *faceNormal = model.faceNormal(i - instance.faces);
+        const int *faceTexture = model.faceTexture(i - instance.faces);
+        bool tangents = !worldTangents_.empty() && !model.tangents_.empty();
+        for (int j = 0; j < 3; j++)
+        {
+            f.screenPoints[j] = screenVertices_[instance.vertices + face[j]];
+            f.worldNormals[j] = worldNormals_[instance.normals + faceNormal[j]];
+            vec3 texture = model.texture(faceTexture[j]);
+            f.worldTextures[j] = vec4(texture.x, texture.y, texture.z, 1);
+            f.worldTangents[j] = tangents ? worldTangents_[instance.tangents + faceTexture[j]] : vec3(0, 0, 0);
+            f.worldBitangents[j] = tangents ? worldBitangents_[instance.tangents + faceTexture[j]] : vec3(0, 0, 0);
+        }
+    }
 
-                frameBuffer.set(x, y, p_color);
-            }
+    void fetchScreenPoints(int i, vec3 *screenPoints)
+    {
+        if (i >= nfaces_)
+        {
+            std::copy(clippedFaces_[i - nfaces_].screenPoints, clippedFaces_[i - nfaces_].screenPoints + 3, screenPoints);
+            return;
+        }
+        const InstanceData &instance = instances_[instanceOf(i)];
+        const int *face = instance.model->face(i - instance.faces);
+        for (int j = 0; j < 3; j++)
+        {
+            screenPoints[j] = screenVertices_[instance.vertices + face[j]];
         }
     }
 
-    /* Fonctionne */
-    void drawTriangleNM(vec3 *screenPoints, vec4 *worldTextures)
+    // Faces left after frustum and backface culling, in submission order. A
+    // face crossing a clipped plane is replaced by the triangles of its
+    // clipped polygon, numbered from nfaces_ on
+    std::vector<int> faces_;
+    std::vector<Face> clippedFaces_;
+
+    // Whether the cull stage drops a triangle, from its signed area on screen.
+    // Degenerate triangles are left to the rasterizer
+    static bool culled(const vec3 *screenPoints, CullMode mode, Winding frontFace)
     {
-        // Boundig box
-        int minX, minY, maxX, maxY;
-        boundingBox(screenPoints, &minX, &minY, &maxX, &maxY);
+        if (mode == CullMode::NONE)
+            return false;
+        double area = (screenPoints[1].x - screenPoints[0].x) * (screenPoints[2].y - screenPoints[0].y) -
+                      (screenPoints[1].y - screenPoints[0].y) * (screenPoints[2].x - screenPoints[0].x);
+        if (area == 0)
+            return false;
+        bool front = (area > 0) == (frontFace == Winding::COUNTER_CLOCKWISE);
+        return front == (mode == CullMode::FRONT);
+    }
 
-        for (int x = minX; x <= maxX; x++)
+    void cullFaces(CullMode mode)
+    {
+        faces_.clear();
+        clippedFaces_.clear();
+        for (const InstanceData &instance : instances_)
         {
-            for (int y = minY; y <= maxY; y++)
+            const unsigned short *outcodes = &outcodes_[instance.vertices];
+            const vec3 *screenVertices = &screenVertices_[instance.vertices];
+            for (int i = 0; i < instance.model->nfaces(); i++)
             {
-                TGAColor p_color = TGAColor(255, 255, 255, 255);
-                vec3 p = vec3(x, y, 0);
-                vec3 bc = barycentric(screenPoints[0], screenPoints[1], screenPoints[2], p);
-                if (bc.x < 0 || bc.y < 0 || bc.z < 0)
+                const int *face = instance.model->face(i);
+                unsigned outside = outcodes[face[0]] & outcodes[face[1]] & outcodes[face[2]];
+                unsigned crossing = (outcodes[face[0]] | outcodes[face[1]] | outcodes[face[2]]) & CLIPPED_PLANES;
+                if (outside & FRUSTUM_PLANES)
+                {
+                    stats.frustumCulled++;
                     continue;
-
-                // ZBuffer
-                p.z = screenPoints[0].z * bc.x + screenPoints[1].z * bc.y + screenPoints[2].z * bc.z;
-                int idx = x + y * frameBuffer.get_width();
-                if (zBuffer[idx] <= p.z)
+                }
+                if (crossing)
+                {
+                    stats.clippedFaces++;
+                    clipFace(instance.faces + i, crossing, mode);
+                    continue;
+                }
+                vec3 screenPoints[3] = {screenVertices[face[0]], screenVertices[face[1]], screenVertices[face[2]]};
+                if (culled(screenPoints, mode, frontFace))
+                {
+                    stats.backfaceCulled++;
                     continue;
+                }
+                faces_.push_back(instance.faces + i);
+            }
+        }
+    }
 
-                zBuffer[idx] = p.z;
+    // Corner of a face being clipped, with its attributes as in Face
+    struct ClipVertex
+    {
+        vec4 clip;
+        vec4 worldNormal;
+        vec4 worldTexture;
+        vec3 worldTangent;
+        vec3 worldBitangent;
+    };
 
-                // UV mapping
-                vec2 uv = vec2(worldTextures[0].x * bc.x + worldTextures[1].x * bc.y + worldTextures[2].x * bc.z,
-                               worldTextures[0].y * bc.x + worldTextures[1].y * bc.y + worldTextures[2].y * bc.z);
-                vec3 normal = model.normalmap(uv);
-                vec4 homogeneous_normal = vec4(normal.x, normal.y, normal.z, 1);
-                vec4 world_normal = model.M * homogeneous_normal;
-                normal = vec3(world_normal.x, world_normal.y, world_normal.z);
+    // Clips the face against the planes (bits of ClipPlane), attributes are
+    // interpolated linearly in clip space along the clipped edges. The
+    // triangles of the clipped polygon go through the cull stage
+    void clipFace(int i, unsigned planes, CullMode mode)
+    {
+        Face f;
+        fetchFace(i, f);
+        const InstanceData &instance = instances_[f.instance];
+        const int *face = instance.model->face(i - instance.faces);
+        // Every plane adds at most one corner
+        ClipVertex polygon[3 + CLIP_PLANES];
+        ClipVertex clipped[3 + CLIP_PLANES];
+        for (int j = 0; j < 3; j++)
+        {
+            polygon[j] = {clipVertices_[instance.vertices + face[j]], f.worldNormals[j], f.worldTextures[j], f.worldTangents[j], f.worldBitangents[j]};
+        }
+        int n = 3;
+        for (int p = 0; p < CLIP_PLANES && n >= 3; p++)
+        {
+            if (!(planes & 1 << p))
+                continue;
+            n = clipPolygon(polygon, n, clipPlanes_[p], clipped, [](const ClipVertex &a, const ClipVertex &b, double t)
+            {
+                ClipVertex v;
+                v.clip = a.clip + (b.clip - a.clip) * t;
+                v.worldNormal = a.worldNormal + (b.worldNormal - a.worldNormal) * t;
+                v.worldTexture = a.worldTexture + (b.worldTexture - a.worldTexture) * t;
+                v.worldTangent = a.worldTangent + (b.worldTangent - a.worldTangent) * t;
+                v.worldBitangent = a.worldBitangent + (b.worldBitangent - a.worldBitangent) * t;
+                return v;
+            });
+            std::copy(clipped, clipped + n, polygon);
+        }
 
-                double intensity = dot(normal, light_dir_);
+        // Fan of triangles around the first corner, in the winding of the face
+        for (int j = 1; j + 1 < n; j++)
+        {
+            Face triangle;
+            triangle.instance = f.instance;
+            triangle.material = f.material;
+            triangle.normal = f.normal;
+            int corners[3] = {0, j, j + 1};
+            for (int k = 0; k < 3; k++)
+            {
+                const ClipVertex &v = polygon[corners[k]];
+                triangle.screenPoints[k] = screenPoint(vec4f(v.clip));
+                triangle.worldNormals[k] = v.worldNormal;
+                triangle.worldTextures[k] = v.worldTexture;
+                triangle.worldTangents[k] = v.worldTangent;
+                triangle.worldBitangents[k] = v.worldBitangent;
+            }
+            if (culled(triangle.screenPoints, mode, frontFace))
+            {
+                stats.backfaceCulled++;
+                continue;
+            }
+            faces_.push_back(nfaces_ + clippedFaces_.size());
+            clippedFaces_.push_back(triangle);
+        }
+    }
+
+    // Visibility buffer: face covering each pixel, -1 for none, and its
+    // barycentric coordinates there
+    std::vector<int> visibleFaces_;
+    std::vector<vec3> visibleBarycentrics_;
+
+    void clearVisibility(const Tile &tile)
+    {
+        TileAddress address = pixelLayout_.address(tile.minX, tile.minY);
+        for (int y = tile.minY; y <= tile.maxY; y++)
+        {
+            std::fill(&visibleFaces_[address.index(tile.minX, y)], &visibleFaces_[address.index(tile.maxX, y)] + 1, -1);
+        }
+    }
+
+    // Depth pass of the visibility buffer, nothing is shaded
+    void drawVisibility(int i, const Tile &tile)
+    {
+        vec3 screenPoints[3];
+        fetchScreenPoints(i, screenPoints);
+
+        TileAddress address = pixelLayout_.address(tile.minX, tile.minY);
+        FrameStats &counters = tileStats(tile);
+        rasterizeDepth(screenPoints, tile, [&](int x, int y, const vec3 &bc)
+        {
+            double z = screenPoints[0].z * bc.x + screenPoints[1].z * bc.y + screenPoints[2].z * bc.z;
+            size_t idx = address.index(x, y);
+            if (!depthTest(idx, z, counters))
+                return;
+            visibleFaces_[idx] = i;
+            visibleBarycentrics_[idx] = bc;
+        });
+    }
 
-                p_color.r *= intensity;
-                p_color.g *= intensity;
-                p_color.b *= intensity;
+    // Shading pass of the visibility buffer: every pixel of the tile covered
+    // by a face is shaded once, like the last fragment drawTriangle would have
+    // written there
+    template <typename S>
+    void shadeVisibility(S &shader, const Tile &tile)
+    {
+        TileAddress address = pixelLayout_.address(tile.minX, tile.minY);
+        [[maybe_unused]] FrameStats &counters = tileStats(tile);
+        int current = -1;
+        Face f;
+        for (int y = tile.minY; y <= tile.maxY; y++)
+        {
+            for (int x = tile.minX; x <= tile.maxX; x++)
+            {
+                size_t idx = address.index(x, y);
+                int i = visibleFaces_[idx];
+                if (i < 0)
+                    continue;
+                // Neighbouring pixels mostly belong to the same face
+                if (i != current)
+                {
+                    fetchFace(i, f);
+                    shader.setup(f);
+                    current = i;
+                }
 
-                frameBuffer.set(x, y, p_color);
+                ENGINE_COUNT(counters.shadedFragments, 1);
+                frame_[idx] = shader.fragment(visibleBarycentrics_[idx]);
             }
         }
     }
 
+    // Fetches the post-transform attributes of a face by index and shades the
+    // fragments of it covering the tile that pass the depth test
+    template <typename S>
+    void drawTriangle(int i, S &shader, const Tile &tile)
+    {
+        Face f;
+        fetchFace(i, f);
+        vec3 *screenPoints = f.screenPoints;
+        TileAddress address = pixelLayout_.address(tile.minX, tile.minY);
+        FrameStats &counters = tileStats(tile);
+        if constexpr (std::is_same_v<S, FullShader>)
+        {
+            if (drawTriangleAVX2(f, shader, tile))
+                return;
+        }
+
+        shader.setup(f);
+        rasterizeDepth(screenPoints, tile, [&](int x, int y, const vec3 &bc)
+        {
+            // ZBuffer
+            double z = screenPoints[0].z * bc.x + screenPoints[1].z * bc.y + screenPoints[2].z * bc.z;
+            size_t idx = address.index(x, y);
+            if (!depthTest(idx, z, counters))
+                return;
+
+            frame_[idx] = shader.fragment(bc);
+        });
+    }
+
+    // FullShader 8 pixels at a time. Returns false when the face is left to
+    // the scalar path
+    bool drawTriangleAVX2(Face &f, const FullShader &shader, const Tile &tile)
+    {
+        const Material &material = *f.material;
+        // Fixed point depth formats are only tested by the scalar path
+        if (!simd || shader.filter != TextureFilter::NEAREST || material.texture_layout() != TextureLayout::ROW_MAJOR ||
+            !(depthBuffer.float64() || depthBuffer.float32()) || !cpuHasAVX2())
+            return false;
+
+        Tile box;
+        double nearest;
+        if (!hiZVisible(f.screenPoints, tile, &box, &nearest))
+            return true;
+
+        TileAddress address = pixelLayout_.address(tile.minX, tile.minY);
+        FullShading s;
+        for (int i = 0; i < 3; i++)
+        {
+            s.screenPoints[i] = f.screenPoints[i];
+            s.uv[i] = vec2(f.worldTextures[i].x, f.worldTextures[i].y);
+        }
+        s.diffuse = textureView(material.diffusemap_);
+        s.normal = NormalView{material.normalmap_.data(), material.normalmap_.get_width(), material.normalmap_.get_height()};
+        s.specular = textureView(material.specularmap_);
+        s.M = *f.normal;
+        s.light = shader.light;
+        s.zBuffer = depthBuffer.float64();
+        s.zBuffer32 = depthBuffer.float32();
+        s.reversedZ = depthBuffer.reversed();
+        s.depthScale = depthBuffer.keyScale();
+        s.depthOffset = depthBuffer.keyOffset();
+        s.frame = frameBuffer.buffer();
+        s.frameOrigin = address.origin;
+        s.frameWidth = address.stride;
+        s.frameBytespp = frameBuffer.get_bytespp();
+        s.stats = &tileStats(tile);
+        if (!drawTriangleFullAVX2(s, tile))
+            return false;
+        hiZ_.touch(box);
+        return true;
+    }
+
+    // Maps normalized device coordinates to pixel coordinates
+    mat4 viewportMatrix()
+    {
+        double w = frameBuffer.get_width();
+        double h = frameBuffer.get_height();
+        mat4 matrix = mat4::identity();
+        matrix[0][0] = w / 2;
+        matrix[0][3] = w / 2;
+        matrix[1][1] = h / 2;
+        matrix[1][3] = h / 2;
+        return matrix;
+    }
+
+    static TextureView textureView(const Texture &texture)
+    {
+        return TextureView{texture.data(), texture.get_width(), texture.get_height(), texture.get_bytespp()};
+    }
+
     /* Fonctionne */
     void drawWireframe(vec3 *screenPoints)
     {
@@ -334,12 +994,17 @@ private:
         }
     }
 
-    void boundingBox(vec3 *screenPoints, int *minX, int *minY, int *maxX, int *maxY)
+    // Bounding box of the triangle clamped to the tile, empty when min > max.
+    // Conservative: contains every pixel the rasterizer may cover. Clamped
+    // before the conversion to int, which is undefined for huge coordinates
+    void boundingBox(vec3 *screenPoints, const Tile &tile, int *minX, int *minY, int *maxX, int *maxY)
     {
-        *minX = std::min(screenPoints[0].x, std::min(screenPoints[1].x, screenPoints[2].x));
-        *minY = std::min(screenPoints[0].y, std::min(screenPoints[1].y, screenPoints[2].y));
-        *maxX = std::max(screenPoints[0].x, std::max(screenPoints[1].x, screenPoints[2].x));
-        *maxY = std::max(screenPoints[0].y, std::max(screenPoints[1].y, screenPoints[2].y));
+        auto clampX = [&tile](double x) { return std::clamp<double>(x, tile.minX - 1, tile.maxX + 1); };
+        auto clampY = [&tile](double y) { return std::clamp<double>(y, tile.minY - 1, tile.maxY + 1); };
+        *minX = std::max<int>(tile.minX, clampX(std::min(screenPoints[0].x, std::min(screenPoints[1].x, screenPoints[2].x))));
+        *minY = std::max<int>(tile.minY, clampY(std::min(screenPoints[0].y, std::min(screenPoints[1].y, screenPoints[2].y))));
+        *maxX = std::min<int>(tile.maxX, clampX(std::max(screenPoints[0].x, std::max(screenPoints[1].x, screenPoints[2].x))));
+        *maxY = std::min<int>(tile.maxY, clampY(std::max(screenPoints[0].y, std::max(screenPoints[1].y, screenPoints[2].y))));
     }
 
     void line(vec3 &p1, vec3 &p2, TGAImage &image, const TGAColor &color)
@@ -0,0 +1,265 @@
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+
+#include "framewriter.hpp"
+
+namespace
+{
+    // Blue, green and red of a pixel of any depth, grayscale repeated
+    inline void bgr(const unsigned char *p, int bytespp, int *b, int *g, int *r)
+    {
+        if (bytespp == 1)
+        {
+            *b = *g = *r = p[0];
+            return;
+        }
+        *b = p[0];
+        *g = p[1];
+        *r = p[2];
+    }
+
+    // 8-bit RGB pixels of the image, top row first. The engine draws the
+    // bottom row first, which Engine::save flips before writing
+    void toRGB(const TGAImage &image, std::vector<unsigned char> &rgb)
+    {
+        int w = image.get_width();
+        int h = image.get_height();
+        int bpp = image.get_bytespp();
+        const unsigned char *data = image.buffer();
+        rgb.resize((size_t)w * h * 3);
+        unsigned char *out = rgb.data();
+        for (int y = h - 1; y >= 0; y--)
+        {
+            const unsigned char *p = data + (size_t)y * w * bpp;
+            for (int x = 0; x < w; x++, p += bpp, out += 3)
+            {
+                int b, g, r;
+                bgr(p, bpp, &b, &g, &r);
+                out[0] = r;
+                out[1] = g;
+                out[2] = b;
+            }
+        }
+    }
+
+    // Y, U and V planes of the image, top row first, BT.601 studio range
+    void toYUV444(const TGAImage &image, std::vector<unsigned char> &yuv)
+    {
+        int w = image.get_width();
+        int h = image.get_height();
+        int bpp = image.get_bytespp();
+        const unsigned char *data = image.buffer();
+        size_t n = (size_t)w * h;
+        yuv.resize(3 * n);
+        unsigned char *Y = yuv.data();
+        unsigned char *U = Y + n;
+        unsigned char *V = U + n;
+        for (int y = h - 1; y >= 0; y--)
+        {
+            const unsigned char *p = data + (size_t)y * w * bpp;
+            for (int x = 0; x < w; x++, p += bpp)
+            {
+                int b, g, r;
+                bgr(p, bpp, &b, &g, &r);
+                *Y++ = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+                *U++ = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+                *V++ = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+            }
+        }
+    }
+
+    bool writePPM(std::ostream &out, const TGAImage &image, std::vector<unsigned char> &rgb)
+    {
+        toRGB(image, rgb);
+        out << "P6\n" << image.get_width() << " " << image.get_height() << "\n255\n";
+        out.write((const char *)rgb.data(), rgb.size());
+        return out.good();
+    }
+}
+
+FrameWriter::FrameWriter(FrameFormat format, const std::string &output, int queue, int fps)
+    : format_(format), output_(output), queue_(std::max(queue, 1)), fps_(fps), gif_(fps)
+{
+    streaming_ = format == FrameFormat::RAW || format == FrameFormat::Y4M || format == FrameFormat::GIF ||
+                 (format == FrameFormat::PPM && output == "-");
+    if (streaming_)
+    {
+        if (output == "-")
+        {
+            stream_ = &std::cout;
+        }
+        else
+        {
+            std::error_code ec;
+            std::filesystem::path parent = std::filesystem::path(output).parent_path();
+            if (!parent.empty())
+                std::filesystem::create_directories(parent, ec);
+            file_.open(output, std::ios::binary);
+            if (file_.is_open())
+                stream_ = &file_;
+            else
+            {
+                std::cerr << "can't open file " << output << "\n";
+                failed_ = true;
+            }
+        }
+    }
+    else
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(output, ec);
+    }
+    thread_ = std::thread(&FrameWriter::run, this);
+}
+
+FrameWriter::~FrameWriter()
+{
+    close();
+}
+
+std::string FrameWriter::extension(FrameFormat format)
+{
+    switch (format)
+    {
+    case FrameFormat::TGA:
+        return ".tga";
+    case FrameFormat::PPM:
+        return ".ppm";
+    case FrameFormat::RAW:
+        return ".rgb";
+    case FrameFormat::Y4M:
+        return ".y4m";
+    case FrameFormat::GIF:
+        return ".gif";
+    }
+    return "";
+}
+
+void FrameWriter::write(int frame, const TGAImage &image, const std::string &name)
+{
+    // Copied before waiting, the engine can start drawing the next frame as
+    // soon as the queue has room
+    std::unique_ptr<Frame> copy(new Frame{image, name});
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [&]
+               { return frame < next_ + queue_ || closing_; });
+    pending_[frame] = std::move(copy);
+    cond_.notify_all();
+}
+
+void FrameWriter::sample(const TGAImage &image)
+{
+    // The writer thread only uses the encoder once a frame was queued
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (format_ == FrameFormat::GIF && next_ == 0 && pending_.empty())
+        gif_.sample(image);
+}
+
+void FrameWriter::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closing_ = true;
+    }
+    cond_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+    if (format_ == FrameFormat::GIF && gif_.started() && !finished_)
+    {
+        failed_ = !gif_.finish(*stream_) || failed_;
+        finished_ = true;
+    }
+    if (stream_)
+        stream_->flush();
+}
+
+bool FrameWriter::failed()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failed_;
+}
+
+void FrameWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        cond_.wait(lock, [&]
+                   { return pending_.count(next_) || closing_; });
+        if (pending_.empty())
+            break;
+        // Once closing, frames that never came are skipped
+        auto it = pending_.begin();
+        std::unique_ptr<Frame> frame = std::move(it->second);
+        next_ = it->first + 1;
+        pending_.erase(it);
+        cond_.notify_all();
+
+        lock.unlock();
+        bool ok = writeFrame(*frame);
+        lock.lock();
+        failed_ = failed_ || !ok;
+    }
+}
+
+bool FrameWriter::writeFrame(Frame &frame)
+{
+    return streaming_ ? writeStream(frame) : writeFile(frame);
+}
+
+bool FrameWriter::writeFile(Frame &frame)
+{
+    std::string filename = output_ + "/" + frame.name;
+    if (format_ == FrameFormat::TGA)
+    {
+        // The frame is a copy, it can be flipped in place
+        frame.image.flip_vertically();
+        return frame.image.write_tga_file(filename.c_str());
+    }
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open())
+    {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    return writePPM(out, frame.image, buffer_);
+}
+
+bool FrameWriter::writeStream(Frame &frame)
+{
+    if (!stream_)
+        return false;
+    std::ostream &out = *stream_;
+    const TGAImage &image = frame.image;
+    switch (format_)
+    {
+    case FrameFormat::PPM:
+        writePPM(out, image, buffer_);
+        break;
+    case FrameFormat::RAW:
+        toRGB(image, buffer_);
+        out.write((const char *)buffer_.data(), buffer_.size());
+        break;
+    case FrameFormat::Y4M:
+        if (!headerWritten_)
+        {
+            out << "YUV4MPEG2 W" << image.get_width() << " H" << image.get_height() << " F" << fps_ << ":1 Ip A1:1 C444\n";
+            headerWritten_ = true;
+        }
+        toYUV444(image, buffer_);
+        out << "FRAME\n";
+        out.write((const char *)buffer_.data(), buffer_.size());
+        break;
+    case FrameFormat::GIF:
+        // Compressed by the writer thread while the next frames render
+        if (!gif_.write(out, image))
+            return false;
+        break;
+    case FrameFormat::TGA:
+        return false;
+    }
+    // Consumers of a pipe get every frame as soon as it is written
+    out.flush();
+    return out.good();
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "tgaimage.hpp"
+#include "gifencoder.hpp"
+
+enum class FrameFormat
+{
+    // One RLE compressed TGA file per frame, like Engine::save
+    TGA,
+    // Binary PPM (P6): one file per frame, or concatenated in a stream
+    PPM,
+    // Stream of 8-bit RGB frames without any header
+    RAW,
+    // YUV4MPEG2 stream, 4:4:4 BT.601 studio range, read by video encoders
+    Y4M,
+    // Animated GIF looping forever, see GifEncoder
+    GIF
+};
+
+// Writes finished frames from a background thread, so that the next frame
+// renders while the previous one is converted and written.
+//
+// Frames are numbered from 0 and written in that order whatever the order in
+// which they are submitted, so threads rendering different frames can share a
+// writer. write() copies the frame and blocks while the frame is more than
+// queue frames ahead of the next one to write.
+class FrameWriter
+{
+public:
+    // TGA and PPM write a file per frame into the output directory, unless a
+    // PPM output is "-". RAW, Y4M and GIF stream every frame into the output
+    // file or pipe, "-" being the standard output
+    FrameWriter(FrameFormat format, const std::string &output, int queue = 2, int fps = 25);
+    // Writes the frames still queued
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    // Queues the frame as it is drawn by the engine, bottom row first. name is
+    // the file name of the per-file formats, without the directory
+    void write(int frame, const TGAImage &image, const std::string &name);
+    // Adds the colors of an image to the palette of a GIF, before the first
+    // frame is written
+    void sample(const TGAImage &image);
+    // Writes the frames still queued and stops the thread
+    void close();
+    // True when a frame could not be written
+    bool failed();
+
+    // File extension of the per-file formats
+    static std::string extension(FrameFormat format);
+
+private:
+    struct Frame
+    {
+        TGAImage image;
+        std::string name;
+    };
+
+    FrameFormat format_;
+    std::string output_;
+    int queue_;
+    int fps_;
+    bool streaming_;
+    std::ofstream file_;
+    std::ostream *stream_ = NULL;
+    bool headerWritten_ = false;
+    // The GIF trailer was written
+    bool finished_ = false;
+    // Converted pixels, only used by the writer thread
+    std::vector<unsigned char> buffer_;
+    GifEncoder gif_;
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    // Frames submitted but not written yet, by number
+    std::map<int, std::unique_ptr<Frame>> pending_;
+    int next_ = 0;
+    bool closing_ = false;
+    bool failed_ = false;
+
+    void run();
+    bool writeFrame(Frame &frame);
+    bool writeFile(Frame &frame);
+    bool writeStream(Frame &frame);
+};
@@ -1,32 +1,47 @@
 #pragma once
 #include <cmath>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
 
-template <int n>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define GEOMETRY_SSE
+#endif
+
+// Vectors and matrices are parameterized on their scalar type: double by
+// default, float for the hot paths. The default constructors leave the
+// components uninitialized, use vec<n>() or mat<m, n>() to get zeros.
+
+template <int n, typename T = double>
 struct vec
 {
-    double data[n];
+    T data[n];
 
-    vec()
+    vec() = default;
+
+    template <typename U>
+    explicit constexpr vec(const vec<n, U> &v)
     {
         for (int i = 0; i < n; i++)
         {
-            data[i] = 0;
+            data[i] = T(v[i]);
         }
     }
 
-    double &operator[](int i)
+    constexpr T &operator[](int i)
     {
         return data[i];
     }
 
-    const double &operator[](int i) const
+    constexpr const T &operator[](int i) const
     {
         return data[i];
     }
 };
 
-template <int n>
-std::ostream &operator<<(std::ostream &out, const vec<n> &a)
+template <int n, typename T>
+std::ostream &operator<<(std::ostream &out, const vec<n, T> &a)
 {
     out << "(";
     for (int i = 0; i < n; i++)
@@ -37,10 +52,10 @@ std::ostream &operator<<(std::ostream &out, const vec<n> &a)
     return out;
 }
 
-template <int n>
-vec<n> operator+(const vec<n> &a, const vec<n> &b)
+template <int n, typename T>
+constexpr vec<n, T> operator+(const vec<n, T> &a, const vec<n, T> &b)
 {
-    vec<n> c;
+    vec<n, T> c;
     for (int i = 0; i < n; i++)
     {
         c[i] = a[i] + b[i];
@@ -48,10 +63,10 @@ vec<n> operator+(const vec<n> &a, const vec<n> &b)
     return c;
 }
 
-template <int n>
-vec<n> operator-(const vec<n> &a, const vec<n> &b)
+template <int n, typename T>
+constexpr vec<n, T> operator-(const vec<n, T> &a, const vec<n, T> &b)
 {
-    vec<n> c;
+    vec<n, T> c;
     for (int i = 0; i < n; i++)
     {
         c[i] = a[i] - b[i];
@@ -59,10 +74,10 @@ vec<n> operator-(const vec<n> &a, const vec<n> &b)
     return c;
 }
 
-template <int n>
-vec<n> operator*(double k, const vec<n> &a)
+template <int n, typename T>
+constexpr vec<n, T> operator*(std::type_identity_t<T> k, const vec<n, T> &a)
 {
-    vec<n> c;
+    vec<n, T> c;
     for (int i = 0; i < n; i++)
     {
         c[i] = k * a[i];
@@ -70,22 +85,22 @@ vec<n> operator*(double k, const vec<n> &a)
     return c;
 }
 
-template <int n>
-vec<n> operator*(const vec<n> &a, double k)
+template <int n, typename T>
+constexpr vec<n, T> operator*(const vec<n, T> &a, std::type_identity_t<T> k)
 {
     return k * a;
 }
 
-template <int n>
-vec<n> operator/(const vec<n> &a, double k)
+template <int n, typename T>
+constexpr vec<n, T> operator/(const vec<n, T> &a, std::type_identity_t<T> k)
 {
     return (1 / k) * a;
 }
 
-template <int n>
-double dot(const vec<n> &a, const vec<n> &b)
+template <int n, typename T>
+constexpr T dot(const vec<n, T> &a, const vec<n, T> &b)
 {
-    double d = 0;
+    T d = 0;
     for (int i = 0; i < n; i++)
     {
         d += a[i] * b[i];
@@ -93,78 +108,93 @@ double dot(const vec<n> &a, const vec<n> &b)
     return d;
 }
 
-template <int n>
-double norm(const vec<n> &a)
+template <int n, typename T>
+T norm(const vec<n, T> &a)
 {
     return std::sqrt(dot(a, a));
 }
 
-template <int n>
-vec<n> normalize(const vec<n> &a)
+template <int n, typename T>
+vec<n, T> normalize(const vec<n, T> &a)
 {
     return (1 / norm(a)) * a;
 }
 
-template <int n>
-vec<n> cross(const vec<n> &a, const vec<n> &b)
+template <int n, typename T>
+constexpr vec<n, T> cross(const vec<n, T> &a, const vec<n, T> &b)
 {
     static_assert(n == 3, "cross product is only defined for 3D vectors");
-    vec<n> c;
+    vec<n, T> c;
     c[0] = a[1] * b[2] - a[2] * b[1];
     c[1] = a[2] * b[0] - a[0] * b[2];
     c[2] = a[0] * b[1] - a[1] * b[0];
     return c;
 }
 
-template <>
-struct vec<2>
+template <typename T>
+struct vec<2, T>
 {
-    double x, y;
+    T x, y;
+
+    vec() = default;
 
-    vec(double x = 0, double y = 0) : x(x), y(y) {}
+    constexpr vec(T x, T y) : x(x), y(y) {}
 
-    double &operator[](int i)
+    template <typename U>
+    explicit constexpr vec(const vec<2, U> &v) : x(v.x), y(v.y) {}
+
+    constexpr T &operator[](int i)
     {
         return i == 0 ? x : y;
     }
 
-    const double &operator[](int i) const
+    constexpr const T &operator[](int i) const
     {
         return i == 0 ? x : y;
     }
 };
 
-template <>
-struct vec<3>
+template <typename T>
+struct vec<3, T>
 {
-    double x, y, z;
+    T x, y, z;
+
+    vec() = default;
 
-    vec(double x = 0, double y = 0, double z = 0) : x(x), y(y), z(z) {}
+    constexpr vec(T x, T y, T z) : x(x), y(y), z(z) {}
 
-    double &operator[](int i)
+    template <typename U>
+    explicit constexpr vec(const vec<3, U> &v) : x(v.x), y(v.y), z(v.z) {}
+
+    constexpr T &operator[](int i)
     {
         return i == 0 ? x : (i == 1 ? y : z);
     }
 
-    const double &operator[](int i) const
+    constexpr const T &operator[](int i) const
     {
         return i == 0 ? x : (i == 1 ? y : z);
     }
 };
 
-template <>
-struct vec<4>
+template <typename T>
+struct alignas(16) vec<4, T>
 {
-    double x, y, z, w;
+    T x, y, z, w;
+
+    vec() = default;
 
-    vec(double x = 0, double y = 0, double z = 0, double w = 0) : x(x), y(y), z(z), w(w) {}
+    constexpr vec(T x, T y, T z, T w) : x(x), y(y), z(z), w(w) {}
 
-    double &operator[](int i)
+    template <typename U>
+    explicit constexpr vec(const vec<4, U> &v) : x(v.x), y(v.y), z(v.z), w(v.w) {}
+
+    constexpr T &operator[](int i)
     {
         return i == 0 ? x : (i == 1 ? y : (i == 2 ? z : w));
     }
 
-    const double &operator[](int i) const
+    constexpr const T &operator[](int i) const
     {
         return i == 0 ? x : (i == 1 ? y : (i == 2 ? z : w));
     }
@@ -174,35 +204,42 @@ using vec2 = vec<2>;
 using vec3 = vec<3>;
 using vec4 = vec<4>;
 
-template <int m, int n>
+using vec2f = vec<2, float>;
+using vec3f = vec<3, float>;
+using vec4f = vec<4, float>;
+
+template <int m, int n, typename T = double>
 struct mat
 {
-    double data[m][n];
+    alignas(m == 4 && n == 4 ? 16 : alignof(T)) T data[m][n];
 
-    mat()
+    mat() = default;
+
+    template <typename U>
+    explicit constexpr mat(const mat<m, n, U> &a)
     {
         for (int i = 0; i < m; i++)
         {
             for (int j = 0; j < n; j++)
             {
-                data[i][j] = 0;
+                data[i][j] = T(a[i][j]);
             }
         }
     }
 
-    double *operator[](int i)
+    constexpr T *operator[](int i)
     {
         return data[i];
     }
 
-    const double *operator[](int i) const
+    constexpr const T *operator[](int i) const
     {
         return data[i];
     }
 
-    static mat<m, n> identity()
+    static constexpr mat<m, n, T> identity()
     {
-        mat<m, n> a;
+        mat<m, n, T> a;
         for (int i = 0; i < m; i++)
         {
             for (int j = 0; j < n; j++)
@@ -213,16 +250,16 @@ struct mat
         return a;
     }
 
-    static mat<m, n> zero()
+    static constexpr mat<m, n, T> zero()
     {
-        return mat<m, n>();
+        return mat<m, n, T>();
     }
 };
 
-template <int m, int n, int l>
-mat<m, l> operator*(const mat<m, n> &a, const mat<n, l> &b)
+template <int m, int n, int l, typename T>
+constexpr mat<m, l, T> operator*(const mat<m, n, T> &a, const mat<n, l, T> &b)
 {
-    mat<m, l> c;
+    mat<m, l, T> c;
     for (int i = 0; i < m; i++)
     {
         for (int j = 0; j < l; j++)
@@ -237,10 +274,10 @@ mat<m, l> operator*(const mat<m, n> &a, const mat<n, l> &b)
     return c;
 }
 
-template <int m, int n>
-vec<m> operator*(const mat<m, n> &a, const vec<n> &b)
+template <int m, int n, typename T>
+constexpr vec<m, T> operator*(const mat<m, n, T> &a, const vec<n, T> &b)
 {
-    vec<m> c;
+    vec<m, T> c;
     for (int i = 0; i < m; i++)
     {
         c[i] = 0;
@@ -252,11 +289,11 @@ vec<m> operator*(const mat<m, n> &a, const vec<n> &b)
     return c;
 }
 
-template <int m, int n>
-mat<n, m> invert(const mat<m, n> &a)
+template <int m, int n, typename T>
+mat<n, m, T> invert(const mat<m, n, T> &a)
 {
-    mat<n, m> b;
-    double det = 0;
+    mat<n, m, T> b;
+    T det = 0;
     for (int i = 0; i < m; i++)
     {
         for (int j = 0; j < n; j++)
@@ -283,55 +320,198 @@ using mat2 = mat<2, 2>;
 using mat3 = mat<3, 3>;
 using mat4 = mat<4, 4>;
 
-inline vec3 barycentric(vec3 p0, vec3 p1, vec3 p2, vec3 p)
+using mat3f = mat<3, 3, float>;
+using mat4f = mat<4, 4, float>;
+
+#ifdef GEOMETRY_SSE
+// SSE versions of the float vec4/mat4 operations, chosen by overload
+// resolution over the generic templates above
+
+inline __m128 load(const vec4f &v)
+{
+    return _mm_load_ps(&v.x);
+}
+
+inline vec4f store(__m128 r)
 {
-    vec3 u = cross(vec3(p2.x - p0.x, p1.x - p0.x, p0.x - p.x), vec3(p2.y - p0.y, p1.y - p0.y, p0.y - p.y));
-    if (std::abs(u.z) < 1)
+    vec4f v;
+    _mm_store_ps(&v.x, r);
+    return v;
+}
+
+inline float horizontalSum(__m128 r)
+{
+    __m128 s = _mm_add_ps(r, _mm_movehl_ps(r, r));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(s);
+}
+
+inline vec4f operator*(const mat4f &a, const vec4f &b)
+{
+    __m128 v = load(b);
+    __m128 r0 = _mm_mul_ps(_mm_load_ps(a[0]), v);
+    __m128 r1 = _mm_mul_ps(_mm_load_ps(a[1]), v);
+    __m128 r2 = _mm_mul_ps(_mm_load_ps(a[2]), v);
+    __m128 r3 = _mm_mul_ps(_mm_load_ps(a[3]), v);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    return store(_mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3)));
+}
+
+inline mat4f operator*(const mat4f &a, const mat4f &b)
+{
+    __m128 b0 = _mm_load_ps(b[0]);
+    __m128 b1 = _mm_load_ps(b[1]);
+    __m128 b2 = _mm_load_ps(b[2]);
+    __m128 b3 = _mm_load_ps(b[3]);
+    mat4f c;
+    for (int i = 0; i < 4; i++)
     {
-        return vec3(-1, 1, 1);
+        __m128 r = _mm_mul_ps(_mm_set1_ps(a[i][0]), b0);
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i][1]), b1));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i][2]), b2));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i][3]), b3));
+        _mm_store_ps(c[i], r);
     }
-    return vec3(1.0 - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
+    return c;
 }
 
-inline mat4 translate(const vec3 &v)
+inline float dot(const vec4f &a, const vec4f &b)
 {
-    mat4 T = mat4::identity();
+    return horizontalSum(_mm_mul_ps(load(a), load(b)));
+}
+
+inline vec4f normalize(const vec4f &a)
+{
+    __m128 v = load(a);
+    __m128 d = _mm_set1_ps(horizontalSum(_mm_mul_ps(v, v)));
+    return store(_mm_div_ps(v, _mm_sqrt_ps(d)));
+}
+
+// Cross product of the xyz parts, w is set to 0
+inline vec4f cross(const vec4f &a, const vec4f &b)
+{
+    __m128 va = load(a);
+    __m128 vb = load(b);
+    __m128 aYZX = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 bYZX = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(va, bYZX), _mm_mul_ps(aYZX, vb));
+    return store(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+}
+#endif
+
+namespace detail
+{
+    // Sine and cosine usable in constant expressions, Taylor series after
+    // reducing the angle to [-pi, pi]
+    constexpr double sinSeries(double x)
+    {
+        const double pi = 3.14159265358979323846;
+        while (x > pi)
+            x -= 2 * pi;
+        while (x < -pi)
+            x += 2 * pi;
+        double term = x;
+        double sum = x;
+        for (int i = 1; i < 12; i++)
+        {
+            term *= -x * x / ((2 * i) * (2 * i + 1));
+            sum += term;
+        }
+        return sum;
+    }
+
+    constexpr double sin(double x)
+    {
+        if (std::is_constant_evaluated())
+            return sinSeries(x);
+        return std::sin(x);
+    }
+
+    constexpr double cos(double x)
+    {
+        if (std::is_constant_evaluated())
+            return sinSeries(x + 3.14159265358979323846 / 2);
+        return std::cos(x);
+    }
+}
+
+template <typename Scalar>
+constexpr mat<4, 4, Scalar> translate(const vec<3, Scalar> &v)
+{
+    mat<4, 4, Scalar> T = mat<4, 4, Scalar>::identity();
     T[0][3] = v[0];
     T[1][3] = v[1];
     T[2][3] = v[2];
     return T;
 }
 
-inline mat4 scale(const vec3 &v)
+template <typename Scalar>
+constexpr mat<4, 4, Scalar> scale(const vec<3, Scalar> &v)
 {
-    mat4 S = mat4::identity();
+    mat<4, 4, Scalar> S = mat<4, 4, Scalar>::identity();
     S[0][0] = v[0];
     S[1][1] = v[1];
     S[2][2] = v[2];
     return S;
 }
 
-inline mat4 rotate(const vec3 &angles)
+// Matrix transforming the normals of a surface transformed by m: the inverse
+// transpose of its linear part, scaled so that a uniform scale keeps the
+// length of the normals. The translation is dropped
+template <typename Scalar>
+mat<4, 4, Scalar> normalMatrix(const mat<4, 4, Scalar> &m)
+{
+    // Cofactors of the upper-left 3x3 block, which is the inverse transpose
+    // times the determinant
+    mat<4, 4, Scalar> n = mat<4, 4, Scalar>::identity();
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+            int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+            n[i][j] = m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1];
+        }
+    }
+    Scalar det = m[0][0] * n[0][0] + m[0][1] * n[0][1] + m[0][2] * n[0][2];
+    // A flattening transform (a zero scale) has no inverse, but its cofactors
+    // still map the normals to the normal of the flattened surface
+    if (det == 0)
+        return n;
+    // The sign is kept so that mirrored surfaces keep outward normals
+    Scalar k = det / std::cbrt(std::abs(det));
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            n[i][j] /= k;
+        }
+    }
+    return n;
+}
+
+template <typename Scalar>
+constexpr mat<4, 4, Scalar> rotate(const vec<3, Scalar> &angles)
 {
     // Convert angles to radians
-    vec3 angles_ = angles * (M_PI / 180.0);
-    mat4 Rx = mat4::identity();
-    Rx[1][1] = std::cos(angles_[0]);
-    Rx[1][2] = -std::sin(angles_[0]);
-    Rx[2][1] = std::sin(angles_[0]);
-    Rx[2][2] = std::cos(angles_[0]);
-
-    mat4 Ry = mat4::identity();
-    Ry[0][0] = std::cos(angles_[1]);
-    Ry[0][2] = std::sin(angles_[1]);
-    Ry[2][0] = -std::sin(angles_[1]);
-    Ry[2][2] = std::cos(angles_[1]);
-
-    mat4 Rz = mat4::identity();
-    Rz[0][0] = std::cos(angles_[2]);
-    Rz[0][1] = -std::sin(angles_[2]);
-    Rz[1][0] = std::sin(angles_[2]);
-    Rz[1][1] = std::cos(angles_[2]);
+    vec<3, Scalar> angles_ = angles * Scalar(3.14159265358979323846 / 180.0);
+    mat<4, 4, Scalar> Rx = mat<4, 4, Scalar>::identity();
+    Rx[1][1] = detail::cos(angles_[0]);
+    Rx[1][2] = -detail::sin(angles_[0]);
+    Rx[2][1] = detail::sin(angles_[0]);
+    Rx[2][2] = detail::cos(angles_[0]);
+
+    mat<4, 4, Scalar> Ry = mat<4, 4, Scalar>::identity();
+    Ry[0][0] = detail::cos(angles_[1]);
+    Ry[0][2] = detail::sin(angles_[1]);
+    Ry[2][0] = -detail::sin(angles_[1]);
+    Ry[2][2] = detail::cos(angles_[1]);
+
+    mat<4, 4, Scalar> Rz = mat<4, 4, Scalar>::identity();
+    Rz[0][0] = detail::cos(angles_[2]);
+    Rz[0][1] = -detail::sin(angles_[2]);
+    Rz[1][0] = detail::sin(angles_[2]);
+    Rz[1][1] = detail::cos(angles_[2]);
 
     return Rz * Ry * Rx;
-}
\ No newline at end of file
+}
@@ -0,0 +1,397 @@
+#include <algorithm>
+#include <cmath>
+
+#include "gifencoder.hpp"
+
+namespace
+{
+    inline int bin(int r, int g, int b)
+    {
+        return (r >> 3) << 10 | (g >> 3) << 5 | (b >> 3);
+    }
+
+    // Red, green and blue of a pixel of any depth, grayscale repeated
+    inline void rgb(const unsigned char *p, int bytespp, int *r, int *g, int *b)
+    {
+        if (bytespp == 1)
+        {
+            *r = *g = *b = p[0];
+            return;
+        }
+        *b = p[0];
+        *g = p[1];
+        *r = p[2];
+    }
+
+    // Colors of a box of the median cut, as histogram bins
+    struct Box
+    {
+        std::vector<int> bins;
+        uint64_t count;
+        int axis;
+        int range;
+    };
+
+    void measure(Box &box, const std::vector<uint32_t> &histogram)
+    {
+        int lo[3] = {31, 31, 31}, hi[3] = {0, 0, 0};
+        box.count = 0;
+        for (int b : box.bins)
+        {
+            int c[3] = {b >> 10, (b >> 5) & 31, b & 31};
+            for (int i = 0; i < 3; i++)
+            {
+                lo[i] = std::min(lo[i], c[i]);
+                hi[i] = std::max(hi[i], c[i]);
+            }
+            box.count += histogram[b];
+        }
+        box.axis = 0;
+        for (int i = 1; i < 3; i++)
+        {
+            if (hi[i] - lo[i] > hi[box.axis] - lo[box.axis])
+                box.axis = i;
+        }
+        box.range = hi[box.axis] - lo[box.axis];
+    }
+
+    inline int channel(int b, int axis)
+    {
+        return (b >> (10 - 5 * axis)) & 31;
+    }
+
+    // Bits of the LZW codes packed least significant first into the data
+    // sub-blocks of up to 255 bytes
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::ostream &out) : out_(out) {}
+
+        void put(int code, int size)
+        {
+            bits_ |= (uint32_t)code << count_;
+            count_ += size;
+            while (count_ >= 8)
+            {
+                byte(bits_ & 0xff);
+                bits_ >>= 8;
+                count_ -= 8;
+            }
+        }
+
+        void flush()
+        {
+            if (count_ > 0)
+                byte(bits_ & 0xff);
+            bits_ = 0;
+            count_ = 0;
+            if (size_ > 0)
+                block();
+            out_.put(0);
+        }
+
+    private:
+        std::ostream &out_;
+        uint32_t bits_ = 0;
+        int count_ = 0;
+        unsigned char buffer_[255];
+        int size_ = 0;
+
+        void byte(unsigned char c)
+        {
+            buffer_[size_++] = c;
+            if (size_ == 255)
+                block();
+        }
+
+        void block()
+        {
+            out_.put(size_);
+            out_.write((const char *)buffer_, size_);
+            size_ = 0;
+        }
+    };
+
+    void put16(std::ostream &out, int v)
+    {
+        out.put(v & 0xff);
+        out.put((v >> 8) & 0xff);
+    }
+}
+
+GifEncoder::GifEncoder(int fps) : histogram_(BINS, 0)
+{
+    // Delays are in hundredths of a second
+    delay_ = std::max(1, (int)std::lround(100.0 / std::max(fps, 1)));
+}
+
+bool GifEncoder::started() const
+{
+    return started_;
+}
+
+void GifEncoder::sample(const TGAImage &image)
+{
+    const unsigned char *p = image.buffer();
+    int bpp = image.get_bytespp();
+    size_t n = (size_t)image.get_width() * image.get_height();
+    for (size_t i = 0; i < n; i++, p += bpp)
+    {
+        int r, g, b;
+        rgb(p, bpp, &r, &g, &b);
+        histogram_[bin(r, g, b)]++;
+    }
+}
+
+void GifEncoder::build_palette()
+{
+    // Median cut: the box with the most pixels times the widest range of
+    // colors is split at the median pixel along that range, until there are
+    // 256 boxes or none can be split
+    std::vector<Box> boxes(1);
+    for (int b = 0; b < BINS; b++)
+    {
+        if (histogram_[b])
+            boxes[0].bins.push_back(b);
+    }
+    measure(boxes[0], histogram_);
+    while (boxes.size() < 256)
+    {
+        int best = -1;
+        for (size_t i = 0; i < boxes.size(); i++)
+        {
+            if (boxes[i].range > 0 && (best < 0 || boxes[i].count * boxes[i].range > boxes[best].count * boxes[best].range))
+                best = i;
+        }
+        if (best < 0)
+            break;
+        Box &box = boxes[best];
+        int axis = box.axis;
+        std::sort(box.bins.begin(), box.bins.end(), [&](int a, int b)
+                  { return channel(a, axis) < channel(b, axis); });
+        // Both halves keep at least one color
+        size_t split = 1;
+        uint64_t below = histogram_[box.bins[0]];
+        while (split < box.bins.size() - 1 && 2 * below < box.count)
+        {
+            below += histogram_[box.bins[split++]];
+        }
+        Box upper;
+        upper.bins.assign(box.bins.begin() + split, box.bins.end());
+        box.bins.resize(split);
+        measure(box, histogram_);
+        measure(upper, histogram_);
+        boxes.push_back(std::move(upper));
+    }
+
+    // Entries are the mean color of their box, the unused ones are black
+    palette_.assign(256 * 3, 0);
+    for (size_t i = 0; i < boxes.size(); i++)
+    {
+        double sum[3] = {0, 0, 0};
+        for (int b : boxes[i].bins)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                sum[c] += ((channel(b, c) << 3) + 4) * (double)histogram_[b];
+            }
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            palette_[3 * i + c] = boxes[i].count ? std::lround(sum[c] / boxes[i].count) : 0;
+        }
+    }
+
+    // Closest entry of every bin, colors never sampled included
+    int entries = std::max<int>(1, boxes.size());
+    lookup_.resize(BINS);
+    for (int b = 0; b < BINS; b++)
+    {
+        int c[3] = {(channel(b, 0) << 3) + 4, (channel(b, 1) << 3) + 4, (channel(b, 2) << 3) + 4};
+        int nearest = 0, distance = 1 << 30;
+        for (int i = 0; i < entries; i++)
+        {
+            int dr = c[0] - palette_[3 * i], dg = c[1] - palette_[3 * i + 1], db = c[2] - palette_[3 * i + 2];
+            int d = dr * dr + dg * dg + db * db;
+            if (d < distance)
+            {
+                distance = d;
+                nearest = i;
+            }
+        }
+        lookup_[b] = nearest;
+    }
+}
+
+void GifEncoder::writeHeader(std::ostream &out)
+{
+    out.write("GIF89a", 6);
+    put16(out, width_);
+    put16(out, height_);
+    // Global color table of 256 entries, 8 bits per channel
+    out.put((char)0xf7);
+    out.put(0);
+    out.put(0);
+    out.write((const char *)palette_.data(), palette_.size());
+    // Loops forever
+    out.put(0x21);
+    out.put((char)0xff);
+    out.put(11);
+    out.write("NETSCAPE2.0", 11);
+    out.put(3);
+    out.put(1);
+    put16(out, 0);
+    out.put(0);
+}
+
+bool GifEncoder::write(std::ostream &out, const TGAImage &image)
+{
+    if (!started_)
+    {
+        width_ = image.get_width();
+        height_ = image.get_height();
+        if (std::all_of(histogram_.begin(), histogram_.end(), [](uint32_t c)
+                        { return c == 0; }))
+            sample(image);
+        build_palette();
+        writeHeader(out);
+        previous_.clear();
+        started_ = true;
+    }
+    if (image.get_width() != width_ || image.get_height() != height_)
+        return false;
+
+    // Indices top row first
+    const unsigned char *data = image.buffer();
+    int bpp = image.get_bytespp();
+    indices_.resize((size_t)width_ * height_);
+    for (int y = 0; y < height_; y++)
+    {
+        const unsigned char *p = data + (size_t)(height_ - 1 - y) * width_ * bpp;
+        unsigned char *index = &indices_[(size_t)y * width_];
+        for (int x = 0; x < width_; x++, p += bpp)
+        {
+            int r, g, b;
+            rgb(p, bpp, &r, &g, &b);
+            index[x] = lookup_[bin(r, g, b)];
+        }
+    }
+
+    // Only the rectangle that changed is stored, the rest of the previous
+    // frame stays on screen. An unchanged frame still stores one pixel
+    int minX = 0, minY = 0, maxX = width_ - 1, maxY = height_ - 1;
+    if (!previous_.empty())
+    {
+        minX = width_;
+        minY = height_;
+        maxX = maxY = -1;
+        for (int y = 0; y < height_; y++)
+        {
+            const unsigned char *a = &indices_[(size_t)y * width_];
+            const unsigned char *b = &previous_[(size_t)y * width_];
+            int x0 = 0, x1 = width_ - 1;
+            while (x0 < width_ && a[x0] == b[x0])
+                x0++;
+            if (x0 == width_)
+                continue;
+            while (a[x1] == b[x1])
+                x1--;
+            minX = std::min(minX, x0);
+            maxX = std::max(maxX, x1);
+            minY = std::min(minY, y);
+            maxY = y;
+        }
+        if (maxY < 0)
+            minX = maxX = minY = maxY = 0;
+    }
+
+    // Graphic control extension: delay, the frame is left in place
+    out.put(0x21);
+    out.put((char)0xf9);
+    out.put(4);
+    out.put(1 << 2);
+    put16(out, delay_);
+    out.put(0);
+    out.put(0);
+
+    // Image descriptor, no local color table
+    out.put(0x2c);
+    put16(out, minX);
+    put16(out, minY);
+    put16(out, maxX - minX + 1);
+    put16(out, maxY - minY + 1);
+    out.put(0);
+    lzw(out, minX, minY, maxX, maxY);
+
+    previous_.swap(indices_);
+    return out.good();
+}
+
+void GifEncoder::lzw(std::ostream &out, int minX, int minY, int maxX, int maxY)
+{
+    const int minCodeSize = 8;
+    const int clearCode = 1 << minCodeSize;
+    const int maxCodes = 4096;
+    out.put(minCodeSize);
+
+    dictionary_.resize(maxCodes * 256, 0);
+    used_.clear();
+    BitWriter bits(out);
+    int codeSize = minCodeSize + 1;
+    // Last code assigned, the end of information code follows the clear code
+    int maxCode = clearCode + 1;
+    bits.put(clearCode, codeSize);
+
+    int current = -1;
+    for (int y = minY; y <= maxY; y++)
+    {
+        const unsigned char *row = &indices_[(size_t)y * width_];
+        for (int x = minX; x <= maxX; x++)
+        {
+            int c = row[x];
+            if (current < 0)
+            {
+                current = c;
+                continue;
+            }
+            int key = current * 256 + c;
+            if (dictionary_[key])
+            {
+                current = dictionary_[key] - 1;
+                continue;
+            }
+            bits.put(current, codeSize);
+            dictionary_[key] = ++maxCode + 1;
+            used_.push_back(key);
+            if (maxCode >= (1 << codeSize))
+                codeSize++;
+            if (maxCode == maxCodes - 1)
+            {
+                // Full dictionary, start over
+                bits.put(clearCode, codeSize);
+                for (int k : used_)
+                {
+                    dictionary_[k] = 0;
+                }
+                used_.clear();
+                codeSize = minCodeSize + 1;
+                maxCode = clearCode + 1;
+            }
+            current = c;
+        }
+    }
+    bits.put(current, codeSize);
+    bits.put(clearCode + 1, codeSize);
+    bits.flush();
+    for (int k : used_)
+    {
+        dictionary_[k] = 0;
+    }
+}
+
+bool GifEncoder::finish(std::ostream &out)
+{
+    out.put(0x3b);
+    out.flush();
+    return out.good();
+}
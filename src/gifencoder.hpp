@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <ostream>
+
+#include "tgaimage.hpp"
+
+// Animated GIF whose frames share a 256 color palette. The palette is built
+// by median cut from the colors of the images given to sample(), or of the
+// first frame when none was. Frames only store the rectangle of pixels that
+// changed since the previous frame, LZW compressed.
+class GifEncoder
+{
+public:
+    explicit GifEncoder(int fps = 25);
+
+    // Adds the colors of the image to the ones the palette is built from,
+    // must be called before the first frame is written
+    void sample(const TGAImage &image);
+
+    // Writes the image as the next frame, bottom row first like the engine
+    // draws it, after the header and the palette for the first frame
+    bool write(std::ostream &out, const TGAImage &image);
+    // Ends the file, once every frame was written
+    bool finish(std::ostream &out);
+
+    // True once the first frame was written
+    bool started() const;
+
+private:
+    // Colors are counted and mapped to the palette over 5 bits per channel
+    static const int BINS = 32 * 32 * 32;
+
+    int delay_;
+    int width_ = 0;
+    int height_ = 0;
+    bool started_ = false;
+    std::vector<uint32_t> histogram_;
+    // RGB of the palette entries, and the closest entry of every bin
+    std::vector<unsigned char> palette_;
+    std::vector<unsigned char> lookup_;
+    // Palette indices of the frame being written and of the previous one
+    std::vector<unsigned char> indices_;
+    std::vector<unsigned char> previous_;
+    // LZW dictionary: code + 1 of the string prefix code followed by a byte
+    std::vector<uint16_t> dictionary_;
+    std::vector<int> used_;
+
+    void build_palette();
+    void writeHeader(std::ostream &out);
+    void lzw(std::ostream &out, int minX, int minY, int maxX, int maxY);
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "rasterizer.hpp"
+#include "depthbuffer.hpp"
+
+// Coarse level of the depth buffer: the farthest depth of every BLOCK x BLOCK
+// block of pixels. A fragment passes the depth test when it is strictly
+// closer than the stored depth, so a triangle whose nearest depth is not
+// closer than the farthest depth of a block cannot change any of its pixels.
+//
+// The farthest depth is recomputed from the depth buffer the first time a
+// block is tested after being drawn to. Blocks never straddle two screen
+// tiles, so tiles rendered in parallel never share one.
+class HierarchicalZ
+{
+public:
+    static const int BLOCK = 8;
+
+    void resize(int width, int height)
+    {
+        width_ = width;
+        height_ = height;
+        blocksX_ = (width + BLOCK - 1) / BLOCK;
+        int blocksY = (height + BLOCK - 1) / BLOCK;
+        farthest_.resize(blocksX_ * blocksY);
+        dirty_.resize(blocksX_ * blocksY);
+        clear();
+    }
+
+    // The depth buffer was reset to its farthest value
+    void clear()
+    {
+        std::fill(farthest_.begin(), farthest_.end(), std::numeric_limits<double>::max());
+        std::fill(dirty_.begin(), dirty_.end(), 0);
+    }
+
+    // Pixels of the rectangle may have been written
+    void touch(const Tile &rect)
+    {
+        for (int by = rect.minY / BLOCK; by <= rect.maxY / BLOCK; by++)
+        {
+            for (int bx = rect.minX / BLOCK; bx <= rect.maxX / BLOCK; bx++)
+            {
+                dirty_[bx + by * blocksX_] = 1;
+            }
+        }
+    }
+
+    // True when no pixel of the blocks overlapping the rectangle would accept
+    // a fragment at depth
+    bool occluded(const DepthBuffer &depthBuffer, const Tile &rect, double depth)
+    {
+        for (int by = rect.minY / BLOCK; by <= rect.maxY / BLOCK; by++)
+        {
+            for (int bx = rect.minX / BLOCK; bx <= rect.maxX / BLOCK; bx++)
+            {
+                if (farthest(depthBuffer, bx, by) > depth)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    int blocksX_ = 0;
+    std::vector<double> farthest_;
+    std::vector<char> dirty_;
+
+    double farthest(const DepthBuffer &depthBuffer, int bx, int by)
+    {
+        int b = bx + by * blocksX_;
+        if (dirty_[b])
+        {
+            Tile block = {bx * BLOCK, by * BLOCK, std::min((bx + 1) * BLOCK, width_) - 1, std::min((by + 1) * BLOCK, height_) - 1};
+            farthest_[b] = depthBuffer.farthest(block);
+            dirty_[b] = 0;
+        }
+        return farthest_[b];
+    }
+};
@@ -6,6 +6,9 @@
 #define M_PI 3.14159265358979323846
 #endif
 #include <string>
+#include <memory>
+#include <cstring>
+#include <charconv>
 
 #include "tgaimage.hpp"
 #include "geometry.hpp"
@@ -13,18 +16,386 @@
 #include "camera.hpp"
 
 #include "engine.hpp"
+#include "framewriter.hpp"
 
 #define WIDTH 800
 #define HEIGHT 800
+// Frames rendered ahead of a GIF sequence to build its palette
+#define GIF_PALETTE_SAMPLES 8
 
-int main(int argc, char const *argv[])
+struct Options
+{
+    // Angles of the frames to render: first, first + step, ... up to last excluded
+    int first = 0;
+    int last = 1;
+    int step = 1;
+    // True when a sequence of frames was requested with --frames
+    bool sequence = false;
+    // True when the angle of a single frame was given
+    bool angle = false;
+    // Axis the model turns around
+    char axis = 'y';
+    // Number of threads, 0 uses all the cores
+    int threads = 0;
+    // Shade with the tangent-space normal map instead of the object-space one
+    bool tangent = false;
+    // Shade each pixel once after a visibility pass
+    bool visibility = false;
+    // Draw the inner eyes along with the head
+    bool eyes = false;
+    // Number of heads per side of the grid drawn
+    int grid = 1;
+    // Print the counters of every frame, and write them as JSON
+    bool stats = false;
+    std::string statsJson;
+    // Chrome trace of the stages and tiles of every frame, empty if none
+    std::string trace;
+    // Filtering of the texture maps
+    TextureFilter filter = TextureFilter::NEAREST;
+    // Order of the texels of the texture maps in memory
+    TextureLayout layout = TextureLayout::ROW_MAJOR;
+    // Faces dropped before rasterization and winding of the front faces
+    CullMode cull = CullMode::BACK;
+    Winding frontFace = Winding::COUNTER_CLOCKWISE;
+    // Storage of the depth buffer, and whether its keys are reversed
+    DepthFormat depth = DepthFormat::FLOAT64;
+    bool reversedZ = false;
+    // Order of the pixels of the frame and depth buffers while drawing
+    FrameLayout frameLayout = FrameLayout::LINEAR;
+    // Output of the frames: a directory of TGA or PPM files, or a file or
+    // pipe every frame is streamed into, "-" being the standard output
+    FrameFormat format = FrameFormat::TGA;
+    std::string output;
+    int fps = 25;
+    // Directory whose OBJ files get their .mesh cache rebuilt, empty if none
+    std::string bake;
+};
+
+static void usage()
+{
+    std::cerr << "usage: engine [degree] [threads]\n"
+              << "       engine --frames first:last[:step] [--axis x|y|z] [--threads n]\n"
+              << "       options: --filter nearest|bilinear|trilinear, --layout row-major|morton, --tangent,\n"
+              << "                --cull none|back|front, --winding ccw|cw, --visibility-buffer, --stats,\n"
+              << "                --stats-json file|-, --trace file,\n"
+              << "                --depth float64|float32|unorm24|unorm16, --reversed-z, --tiled, --eyes, --grid n,\n"
+              << "                --format tga|ppm|raw|y4m|gif, --output directory|file|-, --fps n\n"
+              << "       engine --bake [directory]\n";
+    exit(1);
+}
+
+// Integer at the start of text, the rest going to *rest. Without rest the
+// whole text must be the integer. Prints the usage on malformed numbers
+static int parseInt(const char *text, const char **rest = NULL)
+{
+    int value;
+    const char *end = text + strlen(text);
+    std::from_chars_result r = std::from_chars(text, end, value);
+    if (r.ec != std::errc() || (!rest && r.ptr != end))
+        usage();
+    if (rest)
+        *rest = r.ptr;
+    return value;
+}
+
+static Options parseOptions(int argc, char const *argv[])
+{
+    Options options;
+    int positional = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc)
+        {
+            // first:last[:step]
+            const char *p = argv[++i];
+            options.first = parseInt(p, &p);
+            if (*p++ != ':')
+                usage();
+            options.last = parseInt(p, &p);
+            if (*p == ':')
+                options.step = parseInt(p + 1);
+            else if (*p)
+                usage();
+            if (options.step <= 0 || options.last <= options.first)
+                usage();
+            options.sequence = true;
+        }
+        else if (arg == "--axis" && i + 1 < argc)
+        {
+            options.axis = argv[++i][0];
+            if (options.axis != 'x' && options.axis != 'y' && options.axis != 'z')
+                usage();
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            options.threads = parseInt(argv[++i]);
+        }
+        else if (arg == "--filter" && i + 1 < argc)
+        {
+            std::string filter = argv[++i];
+            if (filter == "nearest")
+                options.filter = TextureFilter::NEAREST;
+            else if (filter == "bilinear")
+                options.filter = TextureFilter::BILINEAR;
+            else if (filter == "trilinear")
+                options.filter = TextureFilter::TRILINEAR;
+            else
+                usage();
+        }
+        else if (arg == "--layout" && i + 1 < argc)
+        {
+            std::string layout = argv[++i];
+            if (layout == "row-major")
+                options.layout = TextureLayout::ROW_MAJOR;
+            else if (layout == "morton")
+                options.layout = TextureLayout::MORTON;
+            else
+                usage();
+        }
+        else if (arg == "--cull" && i + 1 < argc)
+        {
+            std::string cull = argv[++i];
+            if (cull == "none")
+                options.cull = CullMode::NONE;
+            else if (cull == "back")
+                options.cull = CullMode::BACK;
+            else if (cull == "front")
+                options.cull = CullMode::FRONT;
+            else
+                usage();
+        }
+        else if (arg == "--winding" && i + 1 < argc)
+        {
+            std::string winding = argv[++i];
+            if (winding == "ccw")
+                options.frontFace = Winding::COUNTER_CLOCKWISE;
+            else if (winding == "cw")
+                options.frontFace = Winding::CLOCKWISE;
+            else
+                usage();
+        }
+        else if (arg == "--eyes")
+        {
+            options.eyes = true;
+        }
+        else if (arg == "--grid" && i + 1 < argc)
+        {
+            options.grid = parseInt(argv[++i]);
+            if (options.grid <= 0)
+                usage();
+        }
+        else if (arg == "--stats")
+        {
+            options.stats = true;
+        }
+        else if (arg == "--stats-json" && i + 1 < argc)
+        {
+            options.statsJson = argv[++i];
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            options.trace = argv[++i];
+        }
+        else if (arg == "--depth" && i + 1 < argc)
+        {
+            std::string depth = argv[++i];
+            if (depth == "float64")
+                options.depth = DepthFormat::FLOAT64;
+            else if (depth == "float32")
+                options.depth = DepthFormat::FLOAT32;
+            else if (depth == "unorm24")
+                options.depth = DepthFormat::UNORM24;
+            else if (depth == "unorm16")
+                options.depth = DepthFormat::UNORM16;
+            else
+                usage();
+        }
+        else if (arg == "--format" && i + 1 < argc)
+        {
+            std::string format = argv[++i];
+            if (format == "tga")
+                options.format = FrameFormat::TGA;
+            else if (format == "ppm")
+                options.format = FrameFormat::PPM;
+            else if (format == "raw")
+                options.format = FrameFormat::RAW;
+            else if (format == "y4m")
+                options.format = FrameFormat::Y4M;
+            else if (format == "gif")
+                options.format = FrameFormat::GIF;
+            else
+                usage();
+        }
+        else if (arg == "--output" && i + 1 < argc)
+        {
+            options.output = argv[++i];
+        }
+        else if (arg == "--fps" && i + 1 < argc)
+        {
+            options.fps = parseInt(argv[++i]);
+            if (options.fps <= 0)
+                usage();
+        }
+        else if (arg == "--reversed-z")
+        {
+            options.reversedZ = true;
+        }
+        else if (arg == "--tiled")
+        {
+            options.frameLayout = FrameLayout::TILED;
+        }
+        else if (arg == "--visibility-buffer")
+        {
+            options.visibility = true;
+        }
+        else if (arg == "--tangent")
+        {
+            options.tangent = true;
+        }
+        else if (arg == "--bake")
+        {
+            options.bake = (i + 1 < argc && argv[i + 1][0] != '-') ? argv[++i] : "obj";
+        }
+        else if (arg[0] == '-' && !isdigit(arg[1]))
+        {
+            usage();
+        }
+        // Legacy form: engine [degree] [threads]
+        else if (positional == 0)
+        {
+            options.first = parseInt(argv[i]);
+            options.last = options.first + 1;
+            options.angle = true;
+            positional++;
+        }
+        else if (positional == 1)
+        {
+            options.threads = parseInt(argv[i]);
+            positional++;
+        }
+        else
+        {
+            usage();
+        }
+    }
+    if (options.output.empty())
+    {
+        if (options.format == FrameFormat::GIF)
+            options.output = "out/output.gif";
+        else
+            options.output = (options.format == FrameFormat::RAW || options.format == FrameFormat::Y4M) ? "-" : "out";
+    }
+    return options;
+}
+
+// Builds the .mesh cache of every OBJ file under the directory, the caches
+// that are already up to date are left untouched
+static int bake(const std::string &directory)
 {
-    // Define the angle of the model by passing it as an argument to the program
-    int angle = 0;
-    if (argc > 1)
+    std::error_code ec;
+    std::filesystem::recursive_directory_iterator it(directory, ec), end;
+    if (ec)
     {
-        angle = std::stoi(argv[1]);
+        std::cerr << "Failed to open directory: " << directory << std::endl;
+        return 1;
     }
+    for (; it != end; it.increment(ec))
+    {
+        if (!it->is_regular_file() || it->path().extension() != ".obj")
+            continue;
+        std::string filename = it->path().string();
+        Model model(filename);
+        std::cout << Model::cache_filename(filename) << ": " << model.nverts() << " vertices, " << model.nfaces() << " faces" << std::endl;
+    }
+    return 0;
+}
+
+static void printStats(int angle, const FrameStats &stats)
+{
+    std::cerr << "frame " << angle << ": " << stats.submittedFaces << " faces, " << stats.frustumCulled << " outside the frustum, "
+              << stats.clippedFaces << " clipped, " << stats.backfaceCulled << " culled, hierarchical Z rejected " << stats.hiZFaces
+              << " faces, " << stats.hiZBlocks << " blocks\n";
+#ifdef ENGINE_PROFILE
+    std::cerr << "  depth test " << stats.depthPassed << " passed, " << stats.depthFailed << " failed, " << stats.shadedFragments
+              << " fragments shaded over " << stats.coveredPixels << " pixels (overdraw " << stats.overdraw() << "), "
+              << stats.textureSamples << " texture samples\n  ";
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        std::cerr << (i ? ", " : "") << stageName((Stage)i) << " " << stats.stageSeconds[i] * 1e3 << " ms";
+    }
+    std::cerr << "\n";
+#endif
+}
+
+// Writes the counters of the frames and the trace requested by the options
+static bool writeReports(const Options &options, const std::vector<std::pair<int, FrameStats>> &frames, const Profiler &profiler)
+{
+    bool ok = true;
+    if (!options.statsJson.empty())
+        ok = writeStats(options.statsJson, frames) && ok;
+    if (!options.trace.empty())
+        ok = profiler.writeTrace(options.trace) && ok;
+    return ok;
+}
+
+// Maps of a model of the african_head directory: prefix_diffuse.tga, ...
+static std::shared_ptr<Material> loadMaterial(const std::string &prefix, const Options &options)
+{
+    auto material = std::make_shared<Material>();
+    material->set_diffusemap(prefix + "_diffuse.tga");
+    if (options.tangent)
+        material->set_tangentmap(prefix + "_nm_tangent.tga");
+    else
+        material->set_normalmap(prefix + "_nm.tga");
+    material->set_specularmap(prefix + "_spec.tga");
+    material->set_texture_layout(options.layout);
+    return material;
+}
+
+// Grid of heads filling the view. Models and materials are loaded once,
+// every head only adds instances
+static Scene buildScene(const Options &options)
+{
+    auto head = std::make_shared<Model>("obj/african_head/african_head.obj");
+    auto headMaterial = loadMaterial("obj/african_head/african_head", options);
+    std::shared_ptr<Model> eyes;
+    std::shared_ptr<Material> eyesMaterial;
+    if (options.eyes)
+    {
+        eyes = std::make_shared<Model>("obj/african_head/african_head_eye_inner.obj");
+        eyesMaterial = loadMaterial("obj/african_head/african_head_eye_inner", options);
+    }
+
+    Scene scene;
+    int n = options.grid;
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            mat4 transform = translate(vec3(-1 + (2 * x + 1.0) / n, -1 + (2 * y + 1.0) / n, 0)) * scale(vec3(1.0 / n, 1.0 / n, 1.0 / n));
+            scene.add(head, headMaterial, transform);
+            if (eyes)
+                scene.add(eyes, eyesMaterial, transform);
+        }
+    }
+    return scene;
+}
+
+static mat4 turntable(int angle, char axis)
+{
+    // Transformation matrix
+    mat4 T = translate(vec3(0, 0, 0));
+    mat4 S = scale(vec3(1, 1, 1));
+    mat4 R = rotate(vec3(axis == 'x' ? angle : 0, axis == 'y' ? angle : 0, axis == 'z' ? angle : 0));
+    return T * S * R;
+}
+
+int main(int argc, char const *argv[])
+{
+    Options options = parseOptions(argc, argv);
+    if (!options.bake.empty())
+        return bake(options.bake);
 
     // Camera parameters
     vec3 eye = vec3(0, 0, 2.1);
@@ -32,36 +403,117 @@ int main(int argc, char const *argv[])
     double fov = 90, near = 0.1, far = 1000;
     Camera camera(eye, lookat, fov, near, far);
 
-    // Create the engine
-    Engine engine(WIDTH, HEIGHT, camera);
-    engine.addModel("obj/african_head/african_head.obj");
+    // Load the models and their textures once, they are shared by all the frames
+    Scene scene = buildScene(options);
 
-    // Set the textures for the model
-    engine.model.set_diffusemap("obj/african_head/african_head_diffuse.tga");
-    engine.model.set_normalmap("obj/african_head/african_head_nm.tga");
-    engine.model.set_specularmap("obj/african_head/african_head_spec.tga");
+#ifndef ENGINE_PROFILE
+    if (!options.trace.empty() || !options.statsJson.empty())
+        std::cerr << "built without ENGINE_PROFILE: only the face counters are measured\n";
+#endif
+    Profiler profiler;
+    Profiler *trace = options.trace.empty() ? NULL : &profiler;
 
-    // Set the light
-    engine.setLight(vec3(0, 0, 1));
+    // Frames are converted and written by a background thread while the
+    // next ones render
+    std::string extension = FrameWriter::extension(options.format);
 
-    // Transformation matrix
-    mat4 T = translate(vec3(0, 0, 0));
-    mat4 S = scale(vec3(1, 1, 1));
-    mat4 R = rotate(vec3(0, angle, 0));
-    mat4 M = T * S * R;
+    if (!options.sequence)
+    {
+        FrameWriter writer(options.format, options.output, 1, options.fps);
+        // Create the engine
+        Engine engine(WIDTH, HEIGHT, camera);
+        engine.setThreads(options.threads);
+        engine.setFilter(options.filter);
+        engine.setCulling(options.cull, options.frontFace);
+        engine.setDepthFormat(options.depth, options.reversedZ);
+        engine.setFrameLayout(options.frameLayout);
+        engine.visibilityBuffer = options.visibility;
+        engine.scene = scene;
+        engine.profiler = trace;
 
-    // Draw the model after applying the transformation matrix
-    engine.model.M = M;
-    engine.draw(RenderMode::FULL);
+        // Set the light
+        engine.setLight(vec3(0, 0, 1));
 
-    // Save the output image
-    if (argc >= 2)
-    {
-        engine.save("output_" + std::to_string(angle) + ".tga");
+        // Draw the model after applying the transformation matrix
+        engine.M = turntable(options.first, options.axis);
+        engine.draw(options.tangent ? RenderMode::FULL_TANGENT : RenderMode::FULL);
+        engine.resolve();
+        if (options.stats)
+            printStats(options.first, engine.stats);
+
+        // Save the output image
+        if (options.angle)
+        {
+            writer.write(0, engine.frameBuffer, "output_" + std::to_string(options.first) + extension);
+        }
+        else
+        {
+            writer.write(0, engine.frameBuffer, "output" + extension);
+        }
+        writer.close();
+        bool reported = writeReports(options, {{options.first, engine.stats}}, profiler);
+        return writer.failed() || !reported ? 1 : 0;
     }
-    else
+
+    // Sequence: every thread renders whole frames with its own engine, the
+    // tiles of a frame are then rasterized serially
+    int nframes = (options.last - options.first + options.step - 1) / options.step;
+    int threads = options.threads;
+#ifdef _OPENMP
+    if (threads <= 0)
+        threads = omp_get_max_threads();
+#endif
+    // Room for a frame per thread, so that no thread waits on the others
+    FrameWriter writer(options.format, options.output, threads, options.fps);
+    std::vector<std::pair<int, FrameStats>> frames(nframes);
+#pragma omp parallel num_threads(threads)
     {
-        engine.save("output.tga");
+        Engine engine(WIDTH, HEIGHT, camera);
+        engine.setThreads(1);
+        engine.setFilter(options.filter);
+        engine.setCulling(options.cull, options.frontFace);
+        engine.setDepthFormat(options.depth, options.reversedZ);
+        engine.setFrameLayout(options.frameLayout);
+        engine.visibilityBuffer = options.visibility;
+        engine.scene = scene;
+        engine.profiler = trace;
+        engine.setLight(vec3(0, 0, 1));
+
+        // The palette of a GIF is shared by all the frames, it is built from
+        // frames spread over the whole sequence before the first one is written
+        if (options.format == FrameFormat::GIF)
+        {
+            int samples = std::min(nframes, GIF_PALETTE_SAMPLES);
+#pragma omp for schedule(dynamic, 1)
+            for (int s = 0; s < samples; s++)
+            {
+                int angle = options.first + (int)((long)s * nframes / samples) * options.step;
+                engine.clear();
+                engine.M = turntable(angle, options.axis);
+                engine.draw(options.tangent ? RenderMode::FULL_TANGENT : RenderMode::FULL);
+                engine.resolve();
+                writer.sample(engine.frameBuffer);
+            }
+        }
+
+#pragma omp for schedule(dynamic, 1)
+        for (int i = 0; i < nframes; i++)
+        {
+            int angle = options.first + i * options.step;
+            engine.clear();
+            engine.M = turntable(angle, options.axis);
+            engine.draw(options.tangent ? RenderMode::FULL_TANGENT : RenderMode::FULL);
+            engine.resolve();
+            frames[i] = {angle, engine.stats};
+            if (options.stats)
+            {
+#pragma omp critical
+                printStats(angle, engine.stats);
+            }
+            writer.write(i, engine.frameBuffer, "output_" + std::to_string(angle) + extension);
+        }
     }
-    return 0;
+    writer.close();
+    bool reported = writeReports(options, frames, profiler);
+    return writer.failed() || !reported ? 1 : 0;
 }
@@ -0,0 +1,111 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPEDFILE_MMAP
+#else
+#include <fstream>
+#include <vector>
+#endif
+
+// Read-only view of a whole file, memory-mapped when the platform allows it
+// and read into memory otherwise
+class MappedFile
+{
+public:
+    MappedFile() {}
+
+    explicit MappedFile(const std::string &filename)
+    {
+        open(filename);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    bool open(const std::string &filename)
+    {
+        close();
+#ifdef MAPPEDFILE_MMAP
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        size_ = st.st_size;
+        if (size_ > 0)
+        {
+            void *p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+            {
+                ::close(fd);
+                size_ = 0;
+                return false;
+            }
+            data_ = (const char *)p;
+        }
+        ::close(fd);
+        open_ = true;
+        return true;
+#else
+        std::ifstream in(filename, std::ios::binary);
+        if (!in.is_open())
+            return false;
+        buffer_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+        open_ = true;
+        return true;
+#endif
+    }
+
+    void close()
+    {
+#ifdef MAPPEDFILE_MMAP
+        if (data_)
+            munmap((void *)data_, size_);
+#else
+        buffer_.clear();
+#endif
+        data_ = NULL;
+        size_ = 0;
+        open_ = false;
+    }
+
+    bool is_open() const
+    {
+        return open_;
+    }
+
+    const char *data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    const char *data_ = NULL;
+    size_t size_ = 0;
+    bool open_ = false;
+#ifndef MAPPEDFILE_MMAP
+    std::vector<char> buffer_;
+#endif
+};
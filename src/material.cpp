@@ -0,0 +1,74 @@
+#include "material.hpp"
+
+void Material::set_diffusemap(std::string filename)
+{
+    diffusemap_.read_tga_file(filename);
+}
+
+void Material::set_normalmap(std::string filename)
+{
+    normalmap_.read_tga_file(filename);
+}
+
+void Material::set_tangentmap(std::string filename)
+{
+    tangentmap_.read_tga_file(filename);
+}
+
+void Material::set_specularmap(std::string filename)
+{
+    specularmap_.read_tga_file(filename);
+}
+
+void Material::set_texture_layout(TextureLayout layout)
+{
+    diffusemap_.set_layout(layout);
+    normalmap_.set_layout(layout);
+    tangentmap_.set_layout(layout);
+    specularmap_.set_layout(layout);
+}
+
+TextureLayout Material::texture_layout() const
+{
+    return diffusemap_.layout();
+}
+
+TGAColor Material::diffuse(const vec2 &uv) const
+{
+    return diffusemap_.sample(uv);
+}
+
+vec3 Material::normalmap(const vec2 &uv) const
+{
+    return normalmap_.sample(uv);
+}
+
+vec3 Material::tangentmap(const vec2 &uv) const
+{
+    return tangentmap_.sample(uv);
+}
+
+double Material::specular(const vec2 &uv) const
+{
+    return specularmap_.sample(uv).raw[0];
+}
+
+TGAColor Material::diffuse(const vec2 &uv, double lod, TextureFilter filter) const
+{
+    return diffusemap_.sample(uv, lod, filter);
+}
+
+vec3 Material::normalmap(const vec2 &uv, double lod, TextureFilter filter) const
+{
+    return normalmap_.sample(uv, lod, filter);
+}
+
+vec3 Material::tangentmap(const vec2 &uv, double lod, TextureFilter filter) const
+{
+    return tangentmap_.sample(uv, lod, filter);
+}
+
+double Material::specular(const vec2 &uv, double lod, TextureFilter filter) const
+{
+    return specularmap_.sample(uv, lod, filter).raw[0];
+}
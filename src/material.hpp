@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+
+#include "geometry.hpp"
+#include "tgaimage.hpp"
+#include "texture.hpp"
+
+// Texture maps of a surface, shared by all the instances drawn with it
+struct Material
+{
+    Texture diffusemap_;
+    // Normal maps are decoded once at load: object space and tangent space
+    NormalMap normalmap_;
+    NormalMap tangentmap_;
+    Texture specularmap_;
+
+    void set_diffusemap(const std::string filename);
+    void set_normalmap(const std::string filename);
+    void set_tangentmap(const std::string filename);
+    void set_specularmap(const std::string filename);
+    // Stores the texels of every map in the layout
+    void set_texture_layout(TextureLayout layout);
+    TextureLayout texture_layout() const;
+
+    // Nearest texel of the full resolution maps
+    TGAColor diffuse(const vec2 &uv) const;
+    vec3 normalmap(const vec2 &uv) const;
+    vec3 tangentmap(const vec2 &uv) const;
+    double specular(const vec2 &uv) const;
+
+    // Filtered samples at a level of detail given by Texture::lod
+    TGAColor diffuse(const vec2 &uv, double lod, TextureFilter filter) const;
+    vec3 normalmap(const vec2 &uv, double lod, TextureFilter filter) const;
+    vec3 tangentmap(const vec2 &uv, double lod, TextureFilter filter) const;
+    double specular(const vec2 &uv, double lod, TextureFilter filter) const;
+};
@@ -0,0 +1,249 @@
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <functional>
+#include <system_error>
+#include <thread>
+
+#include "model.hpp"
+#include "mappedfile.hpp"
+
+// Binary cache of a parsed OBJ file, mapped back in memory as is: a header
+// followed by the mesh arrays, each starting on a 16-byte boundary
+namespace
+{
+    const char MESH_MAGIC[8] = {'E', 'N', 'G', 'M', 'E', 'S', 'H', '\0'};
+    // Bump whenever the layout or the content of the cache changes
+    const uint32_t MESH_VERSION = 2;
+    // Written as is, a cache read on a machine of the other endianness is rejected
+    const uint32_t MESH_ENDIAN = 0x01020304;
+    const size_t MESH_ALIGN = 16;
+
+    // Header flags
+    const uint32_t MESH_HAS_TANGENTS = 1;
+
+    struct MeshSection
+    {
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    struct MeshHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t endian;
+        uint32_t flags;
+        uint32_t vecSize;
+        // Size and modification time of the OBJ file the cache was built from
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        double bboxMin[3];
+        double bboxMax[3];
+        MeshSection vertices;
+        MeshSection normals;
+        MeshSection textures;
+        MeshSection tangents;
+        MeshSection bitangents;
+        MeshSection faces;
+        MeshSection faceNormals;
+        MeshSection faceTextures;
+    };
+
+    static_assert(alignof(vec3) <= MESH_ALIGN && alignof(int) <= MESH_ALIGN);
+
+    bool sourceStamp(const std::string &filename, uint64_t &size, int64_t &time)
+    {
+        std::error_code ec;
+        size = std::filesystem::file_size(filename, ec);
+        if (ec)
+            return false;
+        time = std::filesystem::last_write_time(filename, ec).time_since_epoch().count();
+        return !ec;
+    }
+
+    size_t align(size_t offset)
+    {
+        return (offset + MESH_ALIGN - 1) / MESH_ALIGN * MESH_ALIGN;
+    }
+
+    template <typename T>
+    bool validSection(const MeshSection &section, size_t fileSize)
+    {
+        return section.offset % MESH_ALIGN == 0 && section.offset <= fileSize &&
+               section.count <= (fileSize - section.offset) / sizeof(T);
+    }
+
+    // Like the OBJ loader, every index must point into its array: the missing
+    // normals and texture coordinates were filled in before the cache was written
+    bool validIndices(std::span<const int> indices, uint64_t count)
+    {
+        for (int i : indices)
+        {
+            if (i < 0 || (uint64_t)i >= count)
+                return false;
+        }
+        return true;
+    }
+
+    // Temporary file a cache is written to, unique to the writing process and
+    // thread so that concurrent writers of the same cache never share it
+    std::string temporaryName(const std::string &cachename)
+    {
+        std::ostringstream name;
+        name << cachename << ".";
+#ifdef MAPPEDFILE_MMAP
+        name << getpid() << ".";
+#endif
+        name << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".tmp";
+        return name.str();
+    }
+
+    template <typename T>
+    std::span<const T> sectionView(const MappedFile &file, const MeshSection &section)
+    {
+        return std::span<const T>((const T *)(file.data() + section.offset), section.count);
+    }
+}
+
+std::string Model::cache_filename(const std::string &filename)
+{
+    return std::filesystem::path(filename).replace_extension(".mesh").string();
+}
+
+bool Model::load_cache(const std::string &filename)
+{
+    uint64_t size;
+    int64_t time;
+    if (!sourceStamp(filename, size, time))
+        return false;
+
+    auto file = std::make_shared<MappedFile>(cache_filename(filename));
+    if (!file->is_open() || file->size() < sizeof(MeshHeader))
+        return false;
+
+    MeshHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, MESH_MAGIC, sizeof(MESH_MAGIC)) != 0 || header.version != MESH_VERSION ||
+        header.endian != MESH_ENDIAN || header.vecSize != sizeof(vec3))
+        return false;
+    // Stale cache: the OBJ file changed since it was written
+    if (header.sourceSize != size || header.sourceTime != time)
+        return false;
+
+    size_t fileSize = file->size();
+    if (!validSection<vec3>(header.vertices, fileSize) || !validSection<vec3>(header.normals, fileSize) ||
+        !validSection<vec3>(header.textures, fileSize) || !validSection<vec3>(header.tangents, fileSize) ||
+        !validSection<vec3>(header.bitangents, fileSize) ||
+        !validSection<int>(header.faces, fileSize) || !validSection<int>(header.faceNormals, fileSize) ||
+        !validSection<int>(header.faceTextures, fileSize))
+        return false;
+    if (header.faces.count % 3 != 0 || header.faceNormals.count != header.faces.count ||
+        header.faceTextures.count != header.faces.count ||
+        (header.tangents.count && header.tangents.count != header.textures.count) ||
+        header.bitangents.count != header.tangents.count ||
+        ((header.flags & MESH_HAS_TANGENTS) != 0) != (header.tangents.count != 0))
+        return false;
+
+    // A truncated or corrupt cache must not make the engine read out of bounds
+    std::span<const int> faces = sectionView<int>(*file, header.faces);
+    std::span<const int> faceNormals = sectionView<int>(*file, header.faceNormals);
+    std::span<const int> faceTextures = sectionView<int>(*file, header.faceTextures);
+    if (!validIndices(faces, header.vertices.count) || !validIndices(faceNormals, header.normals.count) ||
+        !validIndices(faceTextures, header.textures.count))
+        return false;
+
+    vertices_ = sectionView<vec3>(*file, header.vertices);
+    normals_ = sectionView<vec3>(*file, header.normals);
+    textures_ = sectionView<vec3>(*file, header.textures);
+    tangents_ = sectionView<vec3>(*file, header.tangents);
+    bitangents_ = sectionView<vec3>(*file, header.bitangents);
+    faces_ = faces;
+    faceNormals_ = faceNormals;
+    faceTextures_ = faceTextures;
+    bboxMin_ = vec3(header.bboxMin[0], header.bboxMin[1], header.bboxMin[2]);
+    bboxMax_ = vec3(header.bboxMax[0], header.bboxMax[1], header.bboxMax[2]);
+    storage_ = file;
+    return true;
+}
+
+bool Model::save_cache(const std::string &filename) const
+{
+    MeshHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_MAGIC, sizeof(MESH_MAGIC));
+    header.version = MESH_VERSION;
+    header.endian = MESH_ENDIAN;
+    header.flags = tangents_.empty() ? 0 : MESH_HAS_TANGENTS;
+    header.vecSize = sizeof(vec3);
+    if (!sourceStamp(filename, header.sourceSize, header.sourceTime))
+        return false;
+    for (int i = 0; i < 3; i++)
+    {
+        header.bboxMin[i] = bboxMin_[i];
+        header.bboxMax[i] = bboxMax_[i];
+    }
+
+    size_t offset = sizeof(header);
+    auto place = [&offset](MeshSection &section, size_t count, size_t elementSize)
+    {
+        offset = align(offset);
+        section.offset = offset;
+        section.count = count;
+        offset += count * elementSize;
+    };
+    place(header.vertices, vertices_.size(), sizeof(vec3));
+    place(header.normals, normals_.size(), sizeof(vec3));
+    place(header.textures, textures_.size(), sizeof(vec3));
+    place(header.tangents, tangents_.size(), sizeof(vec3));
+    place(header.bitangents, bitangents_.size(), sizeof(vec3));
+    place(header.faces, faces_.size(), sizeof(int));
+    place(header.faceNormals, faceNormals_.size(), sizeof(int));
+    place(header.faceTextures, faceTextures_.size(), sizeof(int));
+
+    // Written to a temporary file then renamed, so that a concurrent reader
+    // never maps a partially written cache
+    std::string cachename = cache_filename(filename);
+    std::string tmpname = temporaryName(cachename);
+    {
+        std::ofstream out(tmpname, std::ios::binary);
+        if (!out.is_open())
+            return false;
+        size_t written = 0;
+        auto write = [&out, &written](const MeshSection &section, const void *data, size_t bytes)
+        {
+            static const char padding[MESH_ALIGN] = {};
+            out.write(padding, section.offset - written);
+            out.write((const char *)data, bytes);
+            written = section.offset + bytes;
+        };
+        out.write((const char *)&header, sizeof(header));
+        written = sizeof(header);
+        write(header.vertices, vertices_.data(), vertices_.size_bytes());
+        write(header.normals, normals_.data(), normals_.size_bytes());
+        write(header.textures, textures_.data(), textures_.size_bytes());
+        write(header.tangents, tangents_.data(), tangents_.size_bytes());
+        write(header.bitangents, bitangents_.data(), bitangents_.size_bytes());
+        write(header.faces, faces_.data(), faces_.size_bytes());
+        write(header.faceNormals, faceNormals_.data(), faceNormals_.size_bytes());
+        write(header.faceTextures, faceTextures_.data(), faceTextures_.size_bytes());
+        if (!out.good())
+        {
+            out.close();
+            std::error_code ec;
+            std::filesystem::remove(tmpname, ec);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpname, cachename, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tmpname, ec);
+        return false;
+    }
+    return true;
+}
@@ -1,150 +1,442 @@
 #include <iostream>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "model.hpp"
+#include "mappedfile.hpp"
 
-Model::Model(const std::string filename)
+namespace
 {
-    std::ifstream in;
-    in.open(filename, std::ifstream::in);
-    if (in.fail())
+    // Files smaller than this are parsed by a single thread
+    const size_t MIN_CHUNK_SIZE = 64 * 1024;
+
+    // Index of a face corner, relative ones (negative in the file) are
+    // resolved against the number of elements read so far
+    struct ObjIndex
+    {
+        int value = -1;
+        bool relative = false;
+    };
+
+    // Everything read from a line-aligned chunk of an OBJ file
+    struct ObjChunk
+    {
+        std::vector<vec3> vertices;
+        std::vector<vec3> normals;
+        std::vector<vec3> textures;
+        std::vector<int> faces;
+        std::vector<int> faceNormals;
+        std::vector<int> faceTextures;
+        // Positions in the index arrays holding indices relative to the
+        // start of the chunk, fixed once the previous chunks are known
+        std::vector<int> relativeFaces;
+        std::vector<int> relativeNormals;
+        std::vector<int> relativeTextures;
+    };
+
+    inline const char *skipSpaces(const char *p, const char *end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            p++;
+        return p;
+    }
+
+    // Missing or malformed components read as 0
+    inline const char *parseVec3(const char *p, const char *end, vec3 &v)
+    {
+        v = vec3(0, 0, 0);
+        for (int i = 0; i < 3; i++)
+        {
+            p = skipSpaces(p, end);
+            if (p < end && *p == '+')
+                p++;
+            std::from_chars_result r = std::from_chars(p, end, v[i]);
+            if (r.ec != std::errc())
+                break;
+            p = r.ptr;
+        }
+        return p;
+    }
+
+    // Index of the n-th element, 1-based or negative from the last one read
+    inline const char *parseIndex(const char *p, const char *end, int count, ObjIndex &index)
     {
-        std::cerr << "Failed to open file: " << filename << std::endl;
-        exit(1);
+        int value = 0;
+        std::from_chars_result r = std::from_chars(p, end, value);
+        if (r.ec != std::errc() || value == 0)
+        {
+            index = ObjIndex();
+            return r.ptr;
+        }
+        if (value > 0)
+        {
+            // in wavefront obj all indices start at 1, not zero
+            index.value = value - 1;
+            index.relative = false;
+        }
+        else
+        {
+            index.value = count + value;
+            index.relative = true;
+        }
+        return r.ptr;
     }
-    std::string line;
-    while (!in.eof())
+
+    inline void emitIndex(const ObjIndex &index, std::vector<int> &indices, std::vector<int> &relative)
     {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, "v "))
-        {
-            iss >> trash;
-            vec3 v;
-            for (int i = 0; i < 3; i++)
+        if (index.relative)
+            relative.push_back(indices.size());
+        indices.push_back(index.value);
+    }
+
+    // Corners are v, v/vt, v//vn or v/vt/vn, polygons are triangulated as a
+    // fan around their first corner
+    void parseFace(const char *p, const char *end, ObjChunk &c, std::vector<ObjIndex> &corners)
+    {
+        corners.clear();
+        while (true)
+        {
+            p = skipSpaces(p, end);
+            if (p >= end)
+                break;
+            ObjIndex v, vt, vn;
+            p = parseIndex(p, end, c.vertices.size(), v);
+            if (p < end && *p == '/')
+            {
+                p++;
+                if (p < end && *p != '/')
+                    p = parseIndex(p, end, c.textures.size(), vt);
+                if (p < end && *p == '/')
+                {
+                    p++;
+                    p = parseIndex(p, end, c.normals.size(), vn);
+                }
+            }
+            if (v.value < 0 && !v.relative)
+                break;
+            corners.push_back(v);
+            corners.push_back(vt);
+            corners.push_back(vn);
+            while (p < end && *p != ' ' && *p != '\t')
+                p++;
+        }
+
+        int n = corners.size() / 3;
+        for (int i = 1; i + 1 < n; i++)
+        {
+            for (int k : {0, i, i + 1})
             {
-                iss >> v[i];
+                emitIndex(corners[3 * k], c.faces, c.relativeFaces);
+                emitIndex(corners[3 * k + 1], c.faceTextures, c.relativeTextures);
+                emitIndex(corners[3 * k + 2], c.faceNormals, c.relativeNormals);
             }
-            vertices_.push_back(v);
         }
-        if (!line.compare(0, 3, "vt "))
+    }
+
+    void parseChunk(const char *p, const char *end, ObjChunk &c)
+    {
+        std::vector<ObjIndex> corners;
+        while (p < end)
         {
-            iss >> trash >> trash;
-            vec3 vt;
-            for (int i = 0; i < 3; i++)
+            const char *eol = (const char *)memchr(p, '\n', end - p);
+            if (!eol)
+                eol = end;
+            const char *line = skipSpaces(p, eol);
+            if (eol - line > 2 && line[0] == 'v' && line[1] == ' ')
             {
-                iss >> vt[i];
+                vec3 v;
+                parseVec3(line + 2, eol, v);
+                c.vertices.push_back(v);
             }
-            textures_.push_back(vt);
+            else if (eol - line > 3 && line[0] == 'v' && line[1] == 't' && line[2] == ' ')
+            {
+                vec3 vt;
+                parseVec3(line + 3, eol, vt);
+                c.textures.push_back(vt);
+            }
+            else if (eol - line > 3 && line[0] == 'v' && line[1] == 'n' && line[2] == ' ')
+            {
+                vec3 n;
+                parseVec3(line + 3, eol, n);
+                c.normals.push_back(n);
+            }
+            else if (eol - line > 2 && line[0] == 'f' && line[1] == ' ')
+            {
+                parseFace(line + 2, eol, c, corners);
+            }
+            p = eol + 1;
+        }
+    }
+
+    template <typename T>
+    void append(std::vector<T> &to, size_t at, const std::vector<T> &from)
+    {
+        std::copy(from.begin(), from.end(), to.begin() + at);
+    }
+
+    // Copies the chunk indices at the given position, resolving the relative
+    // ones with the number of elements of the previous chunks. Returns false
+    // when a relative index points before the first element of the file
+    bool appendIndices(std::vector<int> &to, size_t at, const std::vector<int> &from, const std::vector<int> &relative, int offset)
+    {
+        append(to, at, from);
+        bool valid = true;
+        for (int i : relative)
+        {
+            to[at + i] += offset;
+            valid = valid && to[at + i] >= 0;
+        }
+        return valid;
+    }
+
+    // Indices in [0, count), or -1 for the optional ones of a missing attribute
+    bool validIndices(const std::vector<int> &indices, int count, bool optional)
+    {
+        int lowest = optional ? -1 : 0;
+        for (int i : indices)
+        {
+            if (i < lowest || i >= count)
+                return false;
+        }
+        return true;
+    }
+
+    // Corners without a normal get the smoothed normal of their vertex, and
+    // corners without texture coordinates get (0, 0)
+    void fillMissingAttributes(MeshData &mesh)
+    {
+        if (std::find(mesh.faceTextures.begin(), mesh.faceTextures.end(), -1) != mesh.faceTextures.end())
+        {
+            int missing = mesh.textures.size();
+            mesh.textures.push_back(vec3(0, 0, 0));
+            std::replace(mesh.faceTextures.begin(), mesh.faceTextures.end(), -1, missing);
         }
-        else if (!line.compare(0, 3, "vn "))
+
+        if (std::find(mesh.faceNormals.begin(), mesh.faceNormals.end(), -1) != mesh.faceNormals.end())
         {
-            iss >> trash >> trash;
-            vec3 n;
-            for (int i = 0; i < 3; i++)
+            int first = mesh.normals.size();
+            mesh.normals.resize(first + mesh.vertices.size(), vec3(0, 0, 0));
+            for (size_t i = 0; i < mesh.faces.size(); i += 3)
+            {
+                const int *f = &mesh.faces[i];
+                // Not normalized: larger faces weigh more in the vertex normal
+                vec3 n = cross(mesh.vertices[f[1]] - mesh.vertices[f[0]], mesh.vertices[f[2]] - mesh.vertices[f[0]]);
+                for (int j = 0; j < 3; j++)
+                {
+                    mesh.normals[first + f[j]] = mesh.normals[first + f[j]] + n;
+                }
+            }
+            for (size_t i = first; i < mesh.normals.size(); i++)
             {
-                iss >> n[i];
+                if (norm(mesh.normals[i]) > 0)
+                    mesh.normals[i] = normalize(mesh.normals[i]);
+            }
+            for (size_t i = 0; i < mesh.faceNormals.size(); i++)
+            {
+                if (mesh.faceNormals[i] == -1)
+                    mesh.faceNormals[i] = first + mesh.faces[i];
             }
-            normals_.push_back(n);
         }
-        else if (!line.compare(0, 2, "f "))
+    }
+
+    // Tangent and bitangent of every texture coordinate: the directions of
+    // increasing u and v on the faces using it, summed over these faces and
+    // normalized. Faces with a degenerate mapping are skipped
+    void computeTangents(MeshData &mesh)
+    {
+        mesh.tangents.assign(mesh.textures.size(), vec3(0, 0, 0));
+        mesh.bitangents.assign(mesh.textures.size(), vec3(0, 0, 0));
+        for (size_t i = 0; i < mesh.faces.size(); i += 3)
         {
-            std::vector<int> f;
-            std::vector<int> fn;
-            std::vector<int> ft;
-            int itrash, idx, idxt, idxn;
-            iss >> trash;
-            while (iss >> idx >> trash >> idxt >> trash >> idxn)
+            const int *f = &mesh.faces[i];
+            const int *ft = &mesh.faceTextures[i];
+            vec3 e1 = mesh.vertices[f[1]] - mesh.vertices[f[0]];
+            vec3 e2 = mesh.vertices[f[2]] - mesh.vertices[f[0]];
+            vec3 d1 = mesh.textures[ft[1]] - mesh.textures[ft[0]];
+            vec3 d2 = mesh.textures[ft[2]] - mesh.textures[ft[0]];
+            double det = d1.x * d2.y - d2.x * d1.y;
+            if (std::abs(det) < 1e-12)
+                continue;
+            vec3 t = (e1 * d2.y - e2 * d1.y) / det;
+            vec3 b = (e2 * d1.x - e1 * d2.x) / det;
+            for (int j = 0; j < 3; j++)
             {
-                // in wavefront obj all indices start at 1, not zero
-                idx--;
-                idxt--;
-                idxn--;
-                f.push_back(idx);
-                fn.push_back(idxn);
-                ft.push_back(idxt);
+                mesh.tangents[ft[j]] = mesh.tangents[ft[j]] + t;
+                mesh.bitangents[ft[j]] = mesh.bitangents[ft[j]] + b;
             }
-            faces_.push_back(f);
-            faceNormals_.push_back(fn);
-            faceTextures_.push_back(ft);
+        }
+        for (size_t i = 0; i < mesh.tangents.size(); i++)
+        {
+            if (norm(mesh.tangents[i]) > 0)
+                mesh.tangents[i] = normalize(mesh.tangents[i]);
+            if (norm(mesh.bitangents[i]) > 0)
+                mesh.bitangents[i] = normalize(mesh.bitangents[i]);
         }
     }
-}
 
-int Model::nverts()
-{
-    return vertices_.size();
+    void parseObj(const std::string &filename, MeshData &mesh)
+    {
+        MappedFile file(filename);
+        if (!file.is_open())
+        {
+            std::cerr << "Failed to open file: " << filename << std::endl;
+            exit(1);
+        }
+        const char *begin = file.data();
+        const char *end = begin + file.size();
+
+        // Split the file into chunks ending on a line boundary
+        int nchunks = 1;
+#ifdef _OPENMP
+        nchunks = std::max<int>(1, std::min<size_t>(omp_get_max_threads(), file.size() / MIN_CHUNK_SIZE));
+#endif
+        std::vector<const char *> bounds(nchunks + 1, end);
+        bounds[0] = begin;
+        for (int i = 1; i < nchunks; i++)
+        {
+            const char *p = std::max(bounds[i - 1], begin + file.size() * i / nchunks);
+            const char *eol = (const char *)memchr(p, '\n', end - p);
+            bounds[i] = eol ? eol + 1 : end;
+        }
+
+        std::vector<ObjChunk> chunks(nchunks);
+#pragma omp parallel for schedule(static, 1)
+        for (int i = 0; i < nchunks; i++)
+        {
+            parseChunk(bounds[i], bounds[i + 1], chunks[i]);
+        }
+
+        // Offsets of every chunk in the merged arrays
+        std::vector<size_t> v(nchunks + 1, 0), vn(nchunks + 1, 0), vt(nchunks + 1, 0), f(nchunks + 1, 0);
+        for (int i = 0; i < nchunks; i++)
+        {
+            v[i + 1] = v[i] + chunks[i].vertices.size();
+            vn[i + 1] = vn[i] + chunks[i].normals.size();
+            vt[i + 1] = vt[i] + chunks[i].textures.size();
+            f[i + 1] = f[i] + chunks[i].faces.size();
+        }
+        mesh.vertices.resize(v[nchunks]);
+        mesh.normals.resize(vn[nchunks]);
+        mesh.textures.resize(vt[nchunks]);
+        mesh.faces.resize(f[nchunks]);
+        mesh.faceNormals.resize(f[nchunks]);
+        mesh.faceTextures.resize(f[nchunks]);
+
+        std::vector<char> resolved(nchunks);
+#pragma omp parallel for schedule(static, 1)
+        for (int i = 0; i < nchunks; i++)
+        {
+            const ObjChunk &c = chunks[i];
+            append(mesh.vertices, v[i], c.vertices);
+            append(mesh.normals, vn[i], c.normals);
+            append(mesh.textures, vt[i], c.textures);
+            bool faces = appendIndices(mesh.faces, f[i], c.faces, c.relativeFaces, v[i]);
+            bool normals = appendIndices(mesh.faceNormals, f[i], c.faceNormals, c.relativeNormals, vn[i]);
+            bool textures = appendIndices(mesh.faceTextures, f[i], c.faceTextures, c.relativeTextures, vt[i]);
+            resolved[i] = faces && normals && textures;
+        }
+
+        // Every corner has a vertex, normals and texture coordinates may be missing
+        if (std::find(resolved.begin(), resolved.end(), 0) != resolved.end() ||
+            !validIndices(mesh.faces, mesh.vertices.size(), false) || !validIndices(mesh.faceNormals, mesh.normals.size(), true) ||
+            !validIndices(mesh.faceTextures, mesh.textures.size(), true))
+        {
+            std::cerr << "Invalid face index in file: " << filename << std::endl;
+            exit(1);
+        }
+        fillMissingAttributes(mesh);
+        computeTangents(mesh);
+    }
 }
 
-int Model::nfaces()
+Model::Model(const std::string filename, bool cache)
 {
-    return faces_.size();
+    if (cache && load_cache(filename))
+        return;
+
+    auto mesh = std::make_shared<MeshData>();
+    parseObj(filename, *mesh);
+    adopt(mesh);
+    if (cache)
+        save_cache(filename);
 }
 
-vec3 Model::vert(int i)
+void Model::adopt(std::shared_ptr<const MeshData> mesh)
 {
-    return vertices_[i];
+    vertices_ = mesh->vertices;
+    normals_ = mesh->normals;
+    textures_ = mesh->textures;
+    tangents_ = mesh->tangents;
+    bitangents_ = mesh->bitangents;
+    faces_ = mesh->faces;
+    faceNormals_ = mesh->faceNormals;
+    faceTextures_ = mesh->faceTextures;
+    storage_ = mesh;
+
+    for (size_t i = 0; i < vertices_.size(); i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            bboxMin_[j] = i == 0 ? vertices_[i][j] : std::min(bboxMin_[j], vertices_[i][j]);
+            bboxMax_[j] = i == 0 ? vertices_[i][j] : std::max(bboxMax_[j], vertices_[i][j]);
+        }
+    }
 }
 
-std::vector<int> Model::face(int idx)
+int Model::nverts() const
 {
-    return faces_[idx];
+    return vertices_.size();
 }
 
-vec3 Model::normal(int i)
+int Model::nfaces() const
 {
-    return normals_[i];
+    return faces_.size() / 3;
 }
 
-std::vector<int> Model::faceNormal(int idx)
+int Model::nnormals() const
 {
-    return faceNormals_[idx];
+    return normals_.size();
 }
 
-vec3 Model::texture(int i)
+vec3 Model::vert(int i) const
 {
-    return textures_[i];
+    return vertices_[i];
 }
 
-std::vector<int> Model::faceTexture(int idx)
+const int *Model::face(int idx) const
 {
-    return faceTextures_[idx];
+    return &faces_[3 * idx];
 }
 
-void Model::set_diffusemap(std::string filename)
+vec3 Model::normal(int i) const
 {
-    diffusemap_.read_tga_file(filename.c_str());
-    diffusemap_.flip_vertically();
+    return normals_[i];
 }
 
-void Model::set_normalmap(std::string filename)
+const int *Model::faceNormal(int idx) const
 {
-    normalmap_.read_tga_file(filename.c_str());
-    normalmap_.flip_vertically();
+    return &faceNormals_[3 * idx];
 }
 
-void Model::set_specularmap(std::string filename)
+vec3 Model::texture(int i) const
 {
-    specularmap_.read_tga_file(filename.c_str());
-    specularmap_.flip_vertically();
+    return textures_[i];
 }
 
-TGAColor Model::diffuse(const vec2 &uv)
+vec3 Model::tangent(int i) const
 {
-    return diffusemap_.get(uv[0] * diffusemap_.get_width(), uv[1] * diffusemap_.get_height());
+    return tangents_[i];
 }
 
-vec3 Model::normalmap(const vec2 &uv)
+vec3 Model::bitangent(int i) const
 {
-    TGAColor c = normalmap_.get(uv[0] * normalmap_.get_width(), uv[1] * normalmap_.get_height());
-    vec3 res;
-    for (int i = 0; i < 3; i++)
-    {
-        res[2 - i] = (double)c.raw[i] / 255.0 * 2.0 - 1.0;
-    }
-    return res;
+    return bitangents_[i];
 }
 
-double Model::specular(const vec2 &uv)
+const int *Model::faceTexture(int idx) const
 {
-    return specularmap_.get(uv[0] * specularmap_.get_width(), uv[1] * specularmap_.get_height()).raw[0];
-}
\ No newline at end of file
+    return &faceTextures_[3 * idx];
+}
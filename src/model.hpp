@@ -1,44 +1,71 @@
 #pragma once
 #include <vector>
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <span>
+#include <memory>
 
 #include "geometry.hpp"
-#include "tgaimage.hpp"
 
-struct Model
+// Mesh arrays as built by the OBJ parser
+struct MeshData
 {
-    std::vector<vec3> vertices_;
-    std::vector<std::vector<int>> faces_;
-    std::vector<vec3> normals_;
-    std::vector<std::vector<int>> faceNormals_;
-    std::vector<vec3> textures_;
-    std::vector<std::vector<int>> faceTextures_;
+    std::vector<vec3> vertices;
+    std::vector<vec3> normals;
+    std::vector<vec3> textures;
+    std::vector<vec3> tangents;
+    std::vector<vec3> bitangents;
+    std::vector<int> faces;
+    std::vector<int> faceNormals;
+    std::vector<int> faceTextures;
+};
 
-    TGAImage diffusemap_;
-    TGAImage normalmap_;
-    TGAImage specularmap_;
+// Geometry of a mesh, loaded once and shared by every instance drawing it.
+// Its texture maps are in a Material
+struct Model
+{
+    // Views over the mesh arrays, whose memory is owned by storage_: either a
+    // MeshData filled by the OBJ parser or a memory-mapped .mesh cache
+    std::span<const vec3> vertices_;
+    std::span<const vec3> normals_;
+    std::span<const vec3> textures_;
+    // Tangent frames of the texture mapping (directions of increasing u and
+    // v on the surface), indexed like textures_
+    std::span<const vec3> tangents_;
+    std::span<const vec3> bitangents_;
+    // Triangles as 3 consecutive indices per face into vertices_, normals_
+    // and textures_ respectively
+    std::span<const int> faces_;
+    std::span<const int> faceNormals_;
+    std::span<const int> faceTextures_;
 
-    mat4 M;
+    // Axis-aligned bounding box of the vertices
+    vec3 bboxMin_ = vec3(0, 0, 0);
+    vec3 bboxMax_ = vec3(0, 0, 0);
 
     Model() {}
-    Model(const std::string filename);
-
-    int nverts();
-    int nfaces();
-    vec3 vert(int i);
-    std::vector<int> face(int idx);
-    vec3 normal(int i);
-    std::vector<int> faceNormal(int idx);
-    vec3 texture(int i);
-    std::vector<int> faceTexture(int idx);
-
-    void set_diffusemap(const std::string filename);
-    void set_normalmap(const std::string filename);
-    void set_specularmap(const std::string filename);
-
-    TGAColor diffuse(const vec2 &uv);
-    vec3 normalmap(const vec2 &uv);
-    double specular(const vec2 &uv);
+    // Loads the mesh from its .mesh cache when it is up to date, otherwise
+    // parses the OBJ file and (re)writes the cache if cache is true
+    Model(const std::string filename, bool cache = true);
+
+    // Name of the cache of an OBJ file: foo.obj -> foo.mesh
+    static std::string cache_filename(const std::string &filename);
+
+    int nverts() const;
+    int nfaces() const;
+    int nnormals() const;
+    vec3 vert(int i) const;
+    const int *face(int idx) const;
+    vec3 normal(int i) const;
+    const int *faceNormal(int idx) const;
+    vec3 texture(int i) const;
+    vec3 tangent(int i) const;
+    vec3 bitangent(int i) const;
+    const int *faceTexture(int idx) const;
+
+private:
+    std::shared_ptr<const void> storage_;
+
+    void adopt(std::shared_ptr<const MeshData> data);
+    bool load_cache(const std::string &filename);
+    bool save_cache(const std::string &filename) const;
 };
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+
+#include "profiler.hpp"
+
+namespace
+{
+    // Runs write on the file, or on the standard output for "-"
+    template <typename F>
+    bool writeTo(const std::string &filename, F write)
+    {
+        if (filename == "-")
+        {
+            write(std::cout);
+            std::cout.flush();
+            return std::cout.good();
+        }
+        std::ofstream out(filename);
+        if (!out.is_open())
+        {
+            std::cerr << "can't open file " << filename << "\n";
+            return false;
+        }
+        write(out);
+        return out.good();
+    }
+}
+
+const char *stageName(Stage stage)
+{
+    switch (stage)
+    {
+    case Stage::TRANSFORM:
+        return "transform";
+    case Stage::CULL:
+        return "cull";
+    case Stage::BIN:
+        return "bin";
+    case Stage::RASTER:
+        return "raster";
+    case Stage::RESOLVE:
+        return "resolve";
+    }
+    return "";
+}
+
+bool writeStats(const std::string &filename, const std::vector<std::pair<int, FrameStats>> &frames)
+{
+    return writeTo(filename, [&](std::ostream &out)
+                   {
+        out << std::setprecision(9);
+#ifdef ENGINE_PROFILE
+        out << "{\n  \"profile\": true,\n  \"frames\": [\n";
+#else
+        out << "{\n  \"profile\": false,\n  \"frames\": [\n";
+#endif
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            const FrameStats &s = frames[i].second;
+            out << "    {\"frame\": " << frames[i].first << ", \"submitted_faces\": " << s.submittedFaces
+                << ", \"frustum_culled\": " << s.frustumCulled << ", \"clipped_faces\": " << s.clippedFaces
+                << ", \"backface_culled\": " << s.backfaceCulled << ", \"hiz_faces\": " << s.hiZFaces
+                << ", \"hiz_blocks\": " << s.hiZBlocks << ", \"depth_passed\": " << s.depthPassed
+                << ", \"depth_failed\": " << s.depthFailed << ", \"shaded_fragments\": " << s.shadedFragments
+                << ", \"texture_samples\": " << s.textureSamples << ", \"covered_pixels\": " << s.coveredPixels
+                << ", \"overdraw\": " << s.overdraw() << ", \"stage_ms\": {";
+            for (int j = 0; j < STAGE_COUNT; j++)
+            {
+                out << (j ? ", " : "") << "\"" << stageName((Stage)j) << "\": " << s.stageSeconds[j] * 1e3;
+            }
+            out << "}}" << (i + 1 < frames.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n"; });
+}
+
+void Profiler::record(const char *name, double start, double end)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto thread = threads_.emplace(std::this_thread::get_id(), (int)threads_.size()).first;
+    events_.push_back(Event{name, thread->second, start, end - start});
+}
+
+bool Profiler::writeTrace(const std::string &filename) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Complete events ("X"), times in microseconds
+    return writeTo(filename, [&](std::ostream &out)
+                   {
+        out << std::fixed << std::setprecision(3);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        for (size_t i = 0; i < events_.size(); i++)
+        {
+            const Event &e = events_[i];
+            out << "  {\"name\": \"" << e.name << "\", \"cat\": \"engine\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.thread
+                << ", \"ts\": " << e.start << ", \"dur\": " << e.duration << "}" << (i + 1 < events_.size() ? "," : "") << "\n";
+        }
+        out << "]}\n"; });
+}
@@ -0,0 +1,177 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <utility>
+
+// Stages of Engine::draw timed in FrameStats
+enum class Stage
+{
+    // Vertices of every instance to screen space
+    TRANSFORM,
+    // Frustum culling, clipping and face culling
+    CULL,
+    // Faces to the screen tiles
+    BIN,
+    // Tiles, or lines of the wireframe modes
+    RASTER,
+    // Pixels of the frame moved between rows and tiles
+    RESOLVE
+};
+
+const int STAGE_COUNT = 5;
+
+// Work counters of a frame. The per-pixel ones and the stage times are only
+// measured when the engine is built with ENGINE_PROFILE, and stay 0 otherwise
+struct FrameStats
+{
+    // Faces of the instances drawn, before any culling
+    long submittedFaces = 0;
+    // Faces entirely outside the view frustum, and faces crossing the near
+    // plane or the guard band that were clipped
+    long frustumCulled = 0;
+    long clippedFaces = 0;
+    // Triangles dropped by the cull stage, after clipping
+    long backfaceCulled = 0;
+    // Faces and blocks of pixels rejected by the hierarchical Z test
+    long hiZFaces = 0;
+    long hiZBlocks = 0;
+
+    // Fragments whose depth test passed and failed
+    long depthPassed = 0;
+    long depthFailed = 0;
+    // Fragments shaded, only the visible ones with the visibility buffer, and
+    // the texture map lookups they made
+    long shadedFragments = 0;
+    long textureSamples = 0;
+    // Pixels holding a fragment once the frame is drawn
+    long coveredPixels = 0;
+    // Seconds spent in each stage
+    double stageSeconds[STAGE_COUNT] = {};
+
+    // Fragments shaded per covered pixel
+    double overdraw() const
+    {
+        return coveredPixels ? (double)shadedFragments / coveredPixels : 0;
+    }
+
+    FrameStats &operator+=(const FrameStats &other)
+    {
+        submittedFaces += other.submittedFaces;
+        frustumCulled += other.frustumCulled;
+        clippedFaces += other.clippedFaces;
+        backfaceCulled += other.backfaceCulled;
+        hiZFaces += other.hiZFaces;
+        hiZBlocks += other.hiZBlocks;
+        depthPassed += other.depthPassed;
+        depthFailed += other.depthFailed;
+        shadedFragments += other.shadedFragments;
+        textureSamples += other.textureSamples;
+        coveredPixels += other.coveredPixels;
+        for (int i = 0; i < STAGE_COUNT; i++)
+        {
+            stageSeconds[i] += other.stageSeconds[i];
+        }
+        return *this;
+    }
+};
+
+const char *stageName(Stage stage);
+
+// Writes the counters of every frame, numbered by the first of each pair, as
+// a JSON file, "-" being the standard output
+bool writeStats(const std::string &filename, const std::vector<std::pair<int, FrameStats>> &frames);
+
+// Timeline of the stages and tiles drawn by any number of engines and
+// threads, written in the Chrome trace event format that chrome://tracing and
+// Perfetto open
+class Profiler
+{
+public:
+    Profiler() : epoch_(std::chrono::steady_clock::now()) {}
+
+    // Microseconds since the profiler was created
+    double now() const
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch_).count();
+    }
+
+    // Event of the calling thread between two times given by now()
+    void record(const char *name, double start, double end);
+
+    bool writeTrace(const std::string &filename) const;
+
+private:
+    struct Event
+    {
+        const char *name;
+        int thread;
+        double start;
+        double duration;
+    };
+
+    std::chrono::steady_clock::time_point epoch_;
+    mutable std::mutex mutex_;
+    std::vector<Event> events_;
+    // Small numbers for the threads, in order of their first event
+    std::map<std::thread::id, int> threads_;
+};
+
+// Records the rest of the scope as an event of the profiler, if any
+class ScopedEvent
+{
+public:
+    ScopedEvent(Profiler *profiler, const char *name)
+        : profiler_(profiler), name_(name), start_(profiler ? profiler->now() : 0) {}
+
+    ~ScopedEvent()
+    {
+        if (profiler_)
+            profiler_->record(name_, start_, profiler_->now());
+    }
+
+private:
+    Profiler *profiler_;
+    const char *name_;
+    double start_;
+};
+
+// Adds the time of the rest of the scope to a stage of the frame, and records
+// it as an event of the profiler, if any
+class StageTimer
+{
+public:
+    StageTimer(FrameStats &stats, Stage stage, Profiler *profiler)
+        : stats_(stats), stage_(stage), profiler_(profiler), start_(std::chrono::steady_clock::now()),
+          event_(profiler ? profiler->now() : 0) {}
+
+    ~StageTimer()
+    {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+        stats_.stageSeconds[(int)stage_] += elapsed.count();
+        if (profiler_)
+            profiler_->record(stageName(stage_), event_, profiler_->now());
+    }
+
+private:
+    FrameStats &stats_;
+    Stage stage_;
+    Profiler *profiler_;
+    std::chrono::steady_clock::time_point start_;
+    double event_;
+};
+
+// Instrumentation of the engine, compiled out without ENGINE_PROFILE: the
+// arguments are not even evaluated
+#ifdef ENGINE_PROFILE
+#define ENGINE_COUNT(counter, n) ((counter) += (n))
+#define ENGINE_STAGE(stats, stage, profiler) StageTimer stageTimer_(stats, stage, profiler)
+#define ENGINE_EVENT(profiler, name) ScopedEvent scopedEvent_(profiler, name)
+#else
+#define ENGINE_COUNT(counter, n) ((void)0)
+#define ENGINE_STAGE(stats, stage, profiler) ((void)0)
+#define ENGINE_EVENT(profiler, name) ((void)0)
+#endif
@@ -0,0 +1,261 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+
+#include "geometry.hpp"
+
+// Screen-space rectangle of pixels, bounds included
+struct Tile
+{
+    int minX, minY, maxX, maxY;
+};
+
+// Order of the pixels of the frame and depth buffers in memory
+enum class FrameLayout
+{
+    // Rows of the whole buffer one after the other
+    LINEAR,
+    // Tiles of the engine one after the other in row-major order, rows of a
+    // tile one after the other: the pixels a tile draws are contiguous. Edge
+    // tiles are narrower or shorter, so the buffer keeps its size
+    TILED
+};
+
+// Pixel (x, y) of a tile is at origin + x + y * stride in the buffer
+struct TileAddress
+{
+    size_t origin;
+    int stride;
+
+    size_t index(int x, int y) const
+    {
+        return origin + x + (ptrdiff_t)y * stride;
+    }
+};
+
+// Index of the pixels of a width x height buffer in a layout, tileSize being
+// a power of two
+class PixelLayout
+{
+public:
+    PixelLayout() {}
+    PixelLayout(FrameLayout layout, int width, int height, int tileSize)
+        : layout_(layout), width_(width), height_(height), tileSize_(tileSize) {}
+
+    FrameLayout layout() const
+    {
+        return layout_;
+    }
+
+    // Address of the tile containing pixel (x, y), the whole buffer being
+    // a single tile in the linear layout
+    TileAddress address(int x, int y) const
+    {
+        if (layout_ == FrameLayout::LINEAR)
+            return TileAddress{0, width_};
+        int x0 = x & -tileSize_;
+        int y0 = y & -tileSize_;
+        int w = std::min(tileSize_, width_ - x0);
+        int h = std::min(tileSize_, height_ - y0);
+        // Full rows of tiles above, then the tiles on the left of this row
+        size_t start = (size_t)y0 * width_ + (size_t)x0 * h;
+        return TileAddress{start - x0 - (size_t)y0 * w, w};
+    }
+
+    size_t index(int x, int y) const
+    {
+        return address(x, y).index(x, y);
+    }
+
+private:
+    FrameLayout layout_ = FrameLayout::LINEAR;
+    int width_ = 0;
+    int height_ = 0;
+    int tileSize_ = 1;
+};
+
+// Triangle setup for an edge-function rasterizer: the vertices are snapped to
+// a fixed-point grid and the three edge equations are evaluated with integers,
+// so neighbouring triangles agree exactly on which pixels their shared edge
+// covers. Pixels are sampled at integer coordinates.
+struct TriangleSetup
+{
+    static const int SUBPIXEL_BITS = 8;
+    static const int64_t SUBPIXEL_ONE = int64_t(1) << SUBPIXEL_BITS;
+    // Vertices further than this from the origin (in pixels) are rejected to
+    // keep the edge products within 64 bits
+    static constexpr double GUARD_BAND = 1 << 20;
+
+    // Pixel bounds of the triangle, bounds included
+    int minX, minY, maxX, maxY;
+
+    // Edge function i is the weight of vertex i: its value at the first
+    // pixel of the bounding box and its increments along x and y
+    int64_t edge[3];
+    int64_t stepX[3];
+    int64_t stepY[3];
+    // 0 for top-left edges, -1 otherwise: pixels exactly on an edge are
+    // only covered by the triangle on its top or left side
+    int64_t bias[3];
+
+    // Only divide of the triangle, turns edge values into barycentric coordinates
+    double invArea;
+
+    // Returns false when the triangle covers no pixel of the tile
+    bool setup(const vec3 *screenPoints, const Tile &tile)
+    {
+        int64_t fx[3], fy[3];
+        for (int i = 0; i < 3; i++)
+        {
+            if (!(std::abs(screenPoints[i].x) < GUARD_BAND && std::abs(screenPoints[i].y) < GUARD_BAND))
+                return false;
+            fx[i] = std::llround(screenPoints[i].x * SUBPIXEL_ONE);
+            fy[i] = std::llround(screenPoints[i].y * SUBPIXEL_ONE);
+        }
+
+        int64_t area = (fx[1] - fx[0]) * (fy[2] - fy[0]) - (fy[1] - fy[0]) * (fx[2] - fx[0]);
+        if (area == 0)
+            return false;
+        // Both windings are drawn, clockwise triangles get their edges reversed
+        int64_t sign = area > 0 ? 1 : -1;
+        invArea = 1.0 / (double)(area * sign);
+
+        // Ceil of the minimum and floor of the maximum, in pixels
+        minX = std::max<int64_t>(tile.minX, (std::min({fx[0], fx[1], fx[2]}) + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+        minY = std::max<int64_t>(tile.minY, (std::min({fy[0], fy[1], fy[2]}) + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+        maxX = std::min<int64_t>(tile.maxX, std::max({fx[0], fx[1], fx[2]}) >> SUBPIXEL_BITS);
+        maxY = std::min<int64_t>(tile.maxY, std::max({fy[0], fy[1], fy[2]}) >> SUBPIXEL_BITS);
+        if (minX > maxX || minY > maxY)
+            return false;
+
+        int64_t px = int64_t(minX) << SUBPIXEL_BITS;
+        int64_t py = int64_t(minY) << SUBPIXEL_BITS;
+        for (int i = 0; i < 3; i++)
+        {
+            // Edge from a to b, opposite to vertex i
+            int a = (i + 1) % 3;
+            int b = (i + 2) % 3;
+            int64_t dx = (fx[b] - fx[a]) * sign;
+            int64_t dy = (fy[b] - fy[a]) * sign;
+            edge[i] = dx * (py - fy[a]) - dy * (px - fx[a]);
+            stepX[i] = -dy * SUBPIXEL_ONE;
+            stepY[i] = dx * SUBPIXEL_ONE;
+            bool topLeft = dy < 0 || (dy == 0 && dx > 0);
+            bias[i] = topLeft ? 0 : -1;
+        }
+        return true;
+    }
+};
+
+// Calls fragment(x, y, bc) for every pixel of the tile covered by the
+// triangle, row by row, with bc its barycentric coordinates
+template <typename Fragment>
+void rasterize(const vec3 *screenPoints, const Tile &tile, Fragment &&fragment)
+{
+    TriangleSetup t;
+    if (!t.setup(screenPoints, tile))
+        return;
+
+    int64_t row[3] = {t.edge[0] + t.bias[0], t.edge[1] + t.bias[1], t.edge[2] + t.bias[2]};
+    for (int y = t.minY; y <= t.maxY; y++)
+    {
+        int64_t w0 = row[0];
+        int64_t w1 = row[1];
+        int64_t w2 = row[2];
+        for (int x = t.minX; x <= t.maxX; x++)
+        {
+            if ((w0 | w1 | w2) >= 0)
+            {
+                vec3 bc((w0 - t.bias[0]) * t.invArea, (w1 - t.bias[1]) * t.invArea, (w2 - t.bias[2]) * t.invArea);
+                fragment(x, y, bc);
+            }
+            w0 += t.stepX[0];
+            w1 += t.stepX[1];
+            w2 += t.stepX[2];
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            row[i] += t.stepY[i];
+        }
+    }
+}
+
+// Same as rasterize, walking the pixels by blocks of blockSize x blockSize
+// aligned on multiples of blockSize. Blocks the triangle does not reach are
+// skipped, as are the ones for which visible(block) returns false
+template <typename Visible, typename Fragment>
+void rasterizeBlocks(const vec3 *screenPoints, const Tile &tile, int blockSize, Visible &&visible, Fragment &&fragment)
+{
+    TriangleSetup t;
+    if (!t.setup(screenPoints, tile))
+        return;
+
+    for (int by = t.minY / blockSize * blockSize; by <= t.maxY; by += blockSize)
+    {
+        for (int bx = t.minX / blockSize * blockSize; bx <= t.maxX; bx += blockSize)
+        {
+            Tile block = {std::max(bx, t.minX), std::max(by, t.minY),
+                          std::min(bx + blockSize - 1, t.maxX), std::min(by + blockSize - 1, t.maxY)};
+
+            // Edge values at the first pixel of the block. The block is
+            // outside the triangle when one of them is negative at its 4 corners
+            int64_t row[3];
+            bool outside = false;
+            for (int i = 0; i < 3; i++)
+            {
+                row[i] = t.edge[i] + t.bias[i] + (block.minX - t.minX) * t.stepX[i] + (block.minY - t.minY) * t.stepY[i];
+                int64_t farthest = row[i] + std::max<int64_t>(0, (block.maxX - block.minX) * t.stepX[i]) +
+                                   std::max<int64_t>(0, (block.maxY - block.minY) * t.stepY[i]);
+                outside = outside || farthest < 0;
+            }
+            if (outside || !visible(block))
+                continue;
+
+            for (int y = block.minY; y <= block.maxY; y++)
+            {
+                int64_t w0 = row[0];
+                int64_t w1 = row[1];
+                int64_t w2 = row[2];
+                for (int x = block.minX; x <= block.maxX; x++)
+                {
+                    if ((w0 | w1 | w2) >= 0)
+                    {
+                        vec3 bc((w0 - t.bias[0]) * t.invArea, (w1 - t.bias[1]) * t.invArea, (w2 - t.bias[2]) * t.invArea);
+                        fragment(x, y, bc);
+                    }
+                    w0 += t.stepX[0];
+                    w1 += t.stepX[1];
+                    w2 += t.stepX[2];
+                }
+                for (int i = 0; i < 3; i++)
+                {
+                    row[i] += t.stepY[i];
+                }
+            }
+        }
+    }
+}
+
+// One step of Sutherland-Hodgman clipping: writes to out the part of the
+// convex polygon in (n vertices) on the side of plane where dot(plane,
+// v.clip) >= 0 and returns its number of vertices, at most n + 1. Vertices
+// created on the plane are lerp(a, b, t), t going from a to b
+template <typename Vertex, typename Lerp>
+int clipPolygon(const Vertex *in, int n, const vec4 &plane, Vertex *out, Lerp &&lerp)
+{
+    int count = 0;
+    for (int i = 0; i < n; i++)
+    {
+        const Vertex &a = in[i];
+        const Vertex &b = in[(i + 1) % n];
+        double da = dot(plane, a.clip);
+        double db = dot(plane, b.clip);
+        if (da >= 0)
+            out[count++] = a;
+        if ((da >= 0) != (db >= 0))
+            out[count++] = lerp(a, b, da / (da - db));
+    }
+    return count;
+}
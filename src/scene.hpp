@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include <memory>
+
+#include "geometry.hpp"
+#include "model.hpp"
+#include "material.hpp"
+
+// A model drawn with a material and a transform. Models and materials are
+// shared, an instance only adds its transform
+struct Instance
+{
+    std::shared_ptr<const Model> model;
+    std::shared_ptr<const Material> material;
+    // Applied to the model before Engine::M
+    mat4 transform = mat4::identity();
+};
+
+struct Scene
+{
+    std::vector<Instance> instances;
+
+    void add(std::shared_ptr<const Model> model, std::shared_ptr<const Material> material, const mat4 &transform = mat4::identity())
+    {
+        instances.push_back(Instance{model, material, transform});
+    }
+
+    void clear()
+    {
+        instances.clear();
+    }
+};
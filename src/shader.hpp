@@ -0,0 +1,289 @@
+#pragma once
+#include <cmath>
+#include <concepts>
+#include <algorithm>
+
+#include "geometry.hpp"
+#include "tgaimage.hpp"
+#include "texture.hpp"
+#include "material.hpp"
+
+// Post-transform attributes of the corners of a face
+struct Face
+{
+    vec3 screenPoints[3];
+    vec4 worldNormals[3];
+    vec4 worldTextures[3];
+    // Zero when the tangents are not transformed
+    vec3 worldTangents[3];
+    vec3 worldBitangents[3];
+    // Instance the face belongs to: its index in the engine, its maps and the
+    // matrix its object-space normals are transformed by
+    int instance;
+    const Material *material;
+    const mat4 *normal;
+};
+
+// Programmable stages of the raster modes. The engine rasterizes every face
+// with a copy of the shader per tile: setup() is given the face before its
+// fragments, then fragment() the barycentric coordinates of each fragment
+// that passed the depth test, and returns its color. The rasterizer is
+// instantiated for every shader type, so both calls are inlined.
+//
+// A shader may also declare
+//   static constexpr bool TANGENTS = true;     to get worldTangents and
+//                                              worldBitangents
+//   static constexpr int TEXTURE_SAMPLES = n;  map lookups per fragment,
+//                                              counted in FrameStats
+// and a vertex stage, see VertexShader.
+template <typename S>
+concept Shader = std::copy_constructible<S> && requires(S shader, const Face &face, const vec3 &bc) {
+    shader.setup(face);
+    { shader.fragment(bc) } -> std::convertible_to<TGAColor>;
+};
+
+// Optional vertex stage: the clip-space position of every vertex of an
+// instance, from its object-space position, the world matrix of the instance
+// and the view-projection matrix of the camera. Called once per vertex and
+// frame, in place of viewProjection * world * position. Normals and tangents
+// are still transformed by the world matrix
+template <typename S>
+concept VertexShader = requires(const S shader, const vec3 &position, const mat4 &world, const mat4 &viewProjection) {
+    { shader.vertex(position, world, viewProjection) } -> std::convertible_to<vec4>;
+};
+
+template <typename S>
+constexpr bool shaderTangents()
+{
+    if constexpr (requires { S::TANGENTS; })
+        return S::TANGENTS;
+    return false;
+}
+
+template <typename S>
+constexpr int shaderTextureSamples()
+{
+    if constexpr (requires { S::TEXTURE_SAMPLES; })
+        return S::TEXTURE_SAMPLES;
+    return 0;
+}
+
+// Mip level of the texture over the whole triangle, from the ratio of its
+// area in texels to its area in pixels
+template <typename Map>
+double textureLod(const Map &texture, const Face &face, TextureFilter filter)
+{
+    if (filter == TextureFilter::NEAREST)
+        return 0;
+    const vec3 *screenPoints = face.screenPoints;
+    const vec4 *worldTextures = face.worldTextures;
+    double screenArea = std::abs((screenPoints[1].x - screenPoints[0].x) * (screenPoints[2].y - screenPoints[0].y) -
+                                 (screenPoints[2].x - screenPoints[0].x) * (screenPoints[1].y - screenPoints[0].y));
+    double uvArea = std::abs((worldTextures[1].x - worldTextures[0].x) * (worldTextures[2].y - worldTextures[0].y) -
+                             (worldTextures[2].x - worldTextures[0].x) * (worldTextures[1].y - worldTextures[0].y));
+    return texture.lod(uvArea, screenArea);
+}
+
+// Attributes interpolated at a fragment
+inline vec2 interpolateUV(const Face &face, const vec3 &bc)
+{
+    const vec4 *t = face.worldTextures;
+    return vec2(t[0].x * bc.x + t[1].x * bc.y + t[2].x * bc.z,
+                t[0].y * bc.x + t[1].y * bc.y + t[2].y * bc.z);
+}
+
+inline vec3 interpolateNormal(const Face &face, const vec3 &bc)
+{
+    const vec4 *n = face.worldNormals;
+    return normalize(vec3(n[0].x * bc.x + n[1].x * bc.y + n[2].x * bc.z,
+                          n[0].y * bc.x + n[1].y * bc.y + n[2].y * bc.z,
+                          n[0].z * bc.x + n[1].z * bc.y + n[2].z * bc.z));
+}
+
+// Color scaled by a light factor: black where the factor is negative, and
+// saturated instead of wrapping where it brightens the color past 255
+inline TGAColor lit(TGAColor color, double factor)
+{
+    factor = std::max(factor, 0.0);
+    color.r = std::min(255, int(color.r * factor));
+    color.g = std::min(255, int(color.g * factor));
+    color.b = std::min(255, int(color.b * factor));
+    return color;
+}
+
+// RenderMode::GOURAUD: white lit by the interpolated normal
+struct GouraudShader
+{
+    vec3 light;
+    const Face *face_ = NULL;
+
+    explicit GouraudShader(const vec3 &light) : light(light) {}
+
+    void setup(const Face &face)
+    {
+        face_ = &face;
+    }
+
+    TGAColor fragment(const vec3 &bc) const
+    {
+        TGAColor p_color = TGAColor(255, 255, 255, 255);
+        double intensity = dot(interpolateNormal(*face_, bc), light);
+        return lit(p_color, intensity);
+    }
+};
+
+// RenderMode::TEXTURE: diffuse map lit by the interpolated normal
+struct TextureShader
+{
+    static constexpr int TEXTURE_SAMPLES = 1;
+
+    vec3 light;
+    TextureFilter filter;
+    const Face *face_ = NULL;
+    double diffuseLod_ = 0;
+
+    TextureShader(const vec3 &light, TextureFilter filter) : light(light), filter(filter) {}
+
+    void setup(const Face &face)
+    {
+        face_ = &face;
+        diffuseLod_ = textureLod(face.material->diffusemap_, face, filter);
+    }
+
+    TGAColor fragment(const vec3 &bc) const
+    {
+        double intensity = dot(interpolateNormal(*face_, bc), light);
+        TGAColor p_color = face_->material->diffuse(interpolateUV(*face_, bc), diffuseLod_, filter);
+        return lit(p_color, intensity);
+    }
+};
+
+// RenderMode::NORMALMAP: white lit by the object-space normal map
+struct NormalMapShader
+{
+    static constexpr int TEXTURE_SAMPLES = 1;
+
+    vec3 light;
+    TextureFilter filter;
+    const Face *face_ = NULL;
+    double normalLod_ = 0;
+
+    NormalMapShader(const vec3 &light, TextureFilter filter) : light(light), filter(filter) {}
+
+    void setup(const Face &face)
+    {
+        face_ = &face;
+        normalLod_ = textureLod(face.material->normalmap_, face, filter);
+    }
+
+    TGAColor fragment(const vec3 &bc) const
+    {
+        TGAColor p_color = TGAColor(255, 255, 255, 255);
+        vec3 normal = face_->material->normalmap(interpolateUV(*face_, bc), normalLod_, filter);
+        vec4 world_normal = *face_->normal * vec4(normal.x, normal.y, normal.z, 0);
+        double intensity = dot(vec3(world_normal.x, world_normal.y, world_normal.z), light);
+        return lit(p_color, intensity);
+    }
+};
+
+// RenderMode::FULL: diffuse, specular and ambient lighting of the diffuse
+// map by the object-space normal map
+struct FullShader
+{
+    static constexpr int TEXTURE_SAMPLES = 3;
+
+    vec3 light;
+    TextureFilter filter;
+    const Face *face_ = NULL;
+    // Mip levels of the maps over the face
+    double diffuseLod_ = 0;
+    double normalLod_ = 0;
+    double specularLod_ = 0;
+
+    FullShader(const vec3 &light, TextureFilter filter) : light(light), filter(filter) {}
+
+    void setup(const Face &face)
+    {
+        face_ = &face;
+        setLods(face, face.material->normalmap_);
+    }
+
+    TGAColor fragment(const vec3 &bc) const
+    {
+        vec2 uv = interpolateUV(*face_, bc);
+        vec3 normal = face_->material->normalmap(uv, normalLod_, filter);
+        vec4 world_normal = *face_->normal * vec4(normal.x, normal.y, normal.z, 0);
+        return shade(uv, vec3(world_normal.x, world_normal.y, world_normal.z));
+    }
+
+protected:
+    void setLods(const Face &face, const NormalMap &normalmap)
+    {
+        const Material &material = *face.material;
+        diffuseLod_ = textureLod(material.diffusemap_, face, filter);
+        normalLod_ = textureLod(normalmap, face, filter);
+        specularLod_ = textureLod(material.specularmap_, face, filter);
+    }
+
+    TGAColor shade(const vec2 &uv, const vec3 &normal) const
+    {
+        const Material &material = *face_->material;
+        double intensity = dot(normal, light);
+
+        // Specular mapping
+        vec3 r = normalize(2 * normal * dot(normal, light) - light);
+        double specular = pow(std::max(r.z, 0.0), material.specular(uv, specularLod_, filter));
+
+        // Texture mapping
+        TGAColor p_color = material.diffuse(uv, diffuseLod_, filter);
+
+        p_color = lit(p_color, intensity + 0.6 * specular);
+
+        int ambiant = 5;
+
+        p_color.r = std::min(255, std::max(0, int(p_color.r + ambiant)));
+        p_color.g = std::min(255, std::max(0, int(p_color.g + ambiant)));
+        p_color.b = std::min(255, std::max(0, int(p_color.b + ambiant)));
+        return p_color;
+    }
+};
+
+// RenderMode::FULL_TANGENT: FullShader with the tangent-space normal map, in
+// the frame of the interpolated normal, tangent and bitangent
+struct FullTangentShader : FullShader
+{
+    static constexpr bool TANGENTS = true;
+
+    using FullShader::FullShader;
+
+    void setup(const Face &face)
+    {
+        face_ = &face;
+        setLods(face, face.material->tangentmap_);
+    }
+
+    TGAColor fragment(const vec3 &bc) const
+    {
+        const Face &f = *face_;
+        vec2 uv = interpolateUV(f, bc);
+
+        // Tangent frame, made orthonormal around the interpolated normal
+        vec3 n = interpolateNormal(f, bc);
+        vec3 t = f.worldTangents[0] * bc.x + f.worldTangents[1] * bc.y + f.worldTangents[2] * bc.z;
+        vec3 b = f.worldBitangents[0] * bc.x + f.worldBitangents[1] * bc.y + f.worldBitangents[2] * bc.z;
+        t = t - n * dot(n, t);
+        vec3 normal = n;
+        // Without tangents, the interpolated normal is used as is
+        if (norm(t) > 0)
+        {
+            t = normalize(t);
+            vec3 bn = cross(n, t);
+            // Mirrored mapping
+            if (dot(bn, b) < 0)
+                bn = bn * -1.0;
+            vec3 tn = f.material->tangentmap(uv, normalLod_, filter);
+            normal = normalize(t * tn.x + bn * tn.y + n * tn.z);
+        }
+        return shade(uv, normal);
+    }
+};
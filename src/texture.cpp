@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <cmath>
+
+#include "texture.hpp"
+
+namespace
+{
+    // Texels surrounding uv and the bilinear weights of the right and bottom
+    // ones, texel centers sit at half-integer coordinates
+    struct BilinearTaps
+    {
+        int x0, y0, x1, y1;
+        double tu, tv;
+    };
+
+    BilinearTaps bilinearTaps(const vec2 &uv, int w, int h)
+    {
+        double u = uv[0] * w - 0.5;
+        double v = uv[1] * h - 0.5;
+        double fu = std::floor(u);
+        double fv = std::floor(v);
+        BilinearTaps taps;
+        taps.tu = u - fu;
+        taps.tv = v - fv;
+        taps.x0 = std::clamp<int>(fu, 0, w - 1);
+        taps.y0 = std::clamp<int>(fv, 0, h - 1);
+        taps.x1 = std::clamp<int>(fu + 1, 0, w - 1);
+        taps.y1 = std::clamp<int>(fv + 1, 0, h - 1);
+        return taps;
+    }
+
+    double mipLod(double uvArea, double screenArea, int width, int height)
+    {
+        double texels = uvArea * width * height;
+        if (!(texels > 0) || !(screenArea > 0))
+            return 0;
+        return 0.5 * std::log2(texels / screenArea);
+    }
+
+    // Levels blended by a filter: weight 1 - t for level l and t for l + 1
+    void mipLevels(double lod, int levels, TextureFilter filter, int *l, double *t)
+    {
+        // Magnification always uses the full resolution image
+        lod = std::clamp(lod, 0.0, levels - 1.0);
+        if (filter == TextureFilter::BILINEAR)
+        {
+            *l = std::lround(lod);
+            *t = 0;
+        }
+        else
+        {
+            *l = lod;
+            *t = lod - *l;
+        }
+    }
+
+    // Moves the texels of an image of channels values per texel from one
+    // layout to the other, padding texels are zeroed
+    template <typename T>
+    void relayout(std::vector<T> &data, int width, int height, int channels, TextureLayout from, TextureLayout to)
+    {
+        if (data.empty() || from == to)
+            return;
+        std::vector<T> out(layoutSize(to, width, height) * channels, T(0));
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                const T *src = &data[texelIndex(from, width, x, y) * channels];
+                std::copy(src, src + channels, &out[texelIndex(to, width, x, y) * channels]);
+            }
+        }
+        data.swap(out);
+    }
+}
+
+Texture::Texture() : levels_(1)
+{
+}
+
+Texture::Texture(const TGAImage &image) : levels_(1)
+{
+    Level &level = levels_[0];
+    level.width = image.get_width();
+    level.height = image.get_height();
+    bytespp_ = image.get_bytespp();
+    if (image.buffer())
+    {
+        level.data.assign(image.buffer(), image.buffer() + (size_t)level.width * level.height * bytespp_);
+        build_mipmaps();
+    }
+}
+
+bool Texture::read_tga_file(const std::string &filename)
+{
+    TGAImage image;
+    bool ok = image.read_tga_file(filename.c_str());
+    if (ok)
+        image.flip_vertically();
+    *this = Texture(image);
+    return ok;
+}
+
+void Texture::set_layout(TextureLayout layout)
+{
+    for (Level &level : levels_)
+    {
+        relayout(level.data, level.width, level.height, bytespp_, layout_, layout);
+    }
+    layout_ = layout;
+}
+
+TextureLayout Texture::layout() const
+{
+    return layout_;
+}
+
+int Texture::levels() const
+{
+    return levels_.size();
+}
+
+int Texture::get_width(int level) const
+{
+    return levels_[level].width;
+}
+
+int Texture::get_height(int level) const
+{
+    return levels_[level].height;
+}
+
+int Texture::get_bytespp() const
+{
+    return bytespp_;
+}
+
+const unsigned char *Texture::data(int level) const
+{
+    return levels_[level].data.empty() ? NULL : levels_[level].data.data();
+}
+
+const unsigned char *Texture::texel(const Level &level, int x, int y) const
+{
+    return &level.data[texelIndex(layout_, level.width, x, y) * bytespp_];
+}
+
+TGAColor Texture::get(int l, int x, int y) const
+{
+    const Level &level = levels_[l];
+    if (level.data.empty() || x < 0 || y < 0 || x >= level.width || y >= level.height)
+        return TGAColor();
+    return TGAColor(texel(level, x, y), bytespp_);
+}
+
+void Texture::build_mipmaps()
+{
+    while (true)
+    {
+        const Level &src = levels_.back();
+        int w = src.width;
+        int h = src.height;
+        if (src.data.empty() || (w <= 1 && h <= 1))
+            break;
+
+        // Odd sizes round down, the last row or column folds into its neighbour
+        Level dst;
+        dst.width = std::max(1, w / 2);
+        dst.height = std::max(1, h / 2);
+        dst.data.resize((size_t)dst.width * dst.height * bytespp_);
+        const unsigned char *s = src.data.data();
+        unsigned char *d = dst.data.data();
+        int bpp = bytespp_;
+        for (int y = 0; y < dst.height; y++)
+        {
+            int y0 = std::min(2 * y, h - 1);
+            int y1 = std::min(2 * y + 1, h - 1);
+            for (int x = 0; x < dst.width; x++)
+            {
+                int x0 = std::min(2 * x, w - 1);
+                int x1 = std::min(2 * x + 1, w - 1);
+                for (int c = 0; c < bpp; c++)
+                {
+                    int sum = s[(x0 + y0 * w) * bpp + c] + s[(x1 + y0 * w) * bpp + c] +
+                              s[(x0 + y1 * w) * bpp + c] + s[(x1 + y1 * w) * bpp + c];
+                    d[(x + y * dst.width) * bpp + c] = (sum + 2) / 4;
+                }
+            }
+        }
+        levels_.push_back(std::move(dst));
+    }
+}
+
+double Texture::lod(double uvArea, double screenArea) const
+{
+    return mipLod(uvArea, screenArea, get_width(), get_height());
+}
+
+TGAColor Texture::sample(const vec2 &uv) const
+{
+    return get(0, uv[0] * levels_[0].width, uv[1] * levels_[0].height);
+}
+
+TGAColor Texture::sample(const vec2 &uv, double lod, TextureFilter filter) const
+{
+    if (filter == TextureFilter::NEAREST || levels_[0].data.empty())
+        return sample(uv);
+
+    double color[4] = {0, 0, 0, 0};
+    int l;
+    double t;
+    mipLevels(lod, levels(), filter, &l, &t);
+    bilinear(l, uv, 1 - t, color);
+    if (t > 0)
+        bilinear(l + 1, uv, t, color);
+
+    unsigned char raw[4];
+    for (int c = 0; c < bytespp_; c++)
+    {
+        raw[c] = std::min(255.0, color[c] + 0.5);
+    }
+    return TGAColor(raw, bytespp_);
+}
+
+void Texture::bilinear(int l, const vec2 &uv, double weight, double *color) const
+{
+    const Level &level = levels_[l];
+    BilinearTaps b = bilinearTaps(uv, level.width, level.height);
+    const unsigned char *p00 = texel(level, b.x0, b.y0);
+    const unsigned char *p10 = texel(level, b.x1, b.y0);
+    const unsigned char *p01 = texel(level, b.x0, b.y1);
+    const unsigned char *p11 = texel(level, b.x1, b.y1);
+    for (int c = 0; c < bytespp_; c++)
+    {
+        double top = p00[c] + (p10[c] - p00[c]) * b.tu;
+        double bottom = p01[c] + (p11[c] - p01[c]) * b.tu;
+        color[c] += weight * (top + (bottom - top) * b.tv);
+    }
+}
+
+NormalMap::NormalMap() : levels_(1)
+{
+}
+
+NormalMap::NormalMap(const Texture &texture) : layout_(texture.layout())
+{
+    for (int l = 0; l < texture.levels(); l++)
+    {
+        Level level;
+        level.width = texture.get_width(l);
+        level.height = texture.get_height(l);
+        const unsigned char *p = texture.data(l);
+        if (p)
+        {
+            // Same order as the texture, padding texels included
+            size_t n = layoutSize(layout_, level.width, level.height);
+            int bpp = texture.get_bytespp();
+            level.data.resize(3 * n);
+            for (size_t i = 0; i < n; i++)
+            {
+                // BGR bytes: red is x, green is y and blue is z. Missing
+                // channels of grayscale maps read as 0, like TGAImage::get
+                for (int c = 0; c < 3; c++)
+                {
+                    int value = c < bpp ? p[i * bpp + c] : 0;
+                    level.data[3 * i + 2 - c] = (double)value / 255.0 * 2.0 - 1.0;
+                }
+            }
+        }
+        levels_.push_back(std::move(level));
+    }
+}
+
+bool NormalMap::read_tga_file(const std::string &filename)
+{
+    Texture texture;
+    bool ok = texture.read_tga_file(filename);
+    *this = NormalMap(texture);
+    return ok;
+}
+
+void NormalMap::set_layout(TextureLayout layout)
+{
+    for (Level &level : levels_)
+    {
+        relayout(level.data, level.width, level.height, 3, layout_, layout);
+    }
+    layout_ = layout;
+}
+
+TextureLayout NormalMap::layout() const
+{
+    return layout_;
+}
+
+int NormalMap::levels() const
+{
+    return levels_.size();
+}
+
+const float *NormalMap::data(int level) const
+{
+    return levels_[level].data.empty() ? NULL : levels_[level].data.data();
+}
+
+int NormalMap::get_width() const
+{
+    return levels_[0].width;
+}
+
+int NormalMap::get_height() const
+{
+    return levels_[0].height;
+}
+
+double NormalMap::lod(double uvArea, double screenArea) const
+{
+    return mipLod(uvArea, screenArea, get_width(), get_height());
+}
+
+const float *NormalMap::texel(const Level &level, int x, int y) const
+{
+    return &level.data[3 * texelIndex(layout_, level.width, x, y)];
+}
+
+vec3 NormalMap::sample(const vec2 &uv) const
+{
+    const Level &level = levels_[0];
+    int x = uv[0] * level.width;
+    int y = uv[1] * level.height;
+    // Outside the map reads as a black texel, like TGAImage::get
+    if (level.data.empty() || x < 0 || y < 0 || x >= level.width || y >= level.height)
+        return vec3(-1, -1, -1);
+    const float *p = texel(level, x, y);
+    return vec3(p[0], p[1], p[2]);
+}
+
+vec3 NormalMap::sample(const vec2 &uv, double lod, TextureFilter filter) const
+{
+    if (filter == TextureFilter::NEAREST || levels_[0].data.empty())
+        return sample(uv);
+
+    vec3 n = vec3(0, 0, 0);
+    int l;
+    double t;
+    mipLevels(lod, levels(), filter, &l, &t);
+    bilinear(l, uv, 1 - t, n);
+    if (t > 0)
+        bilinear(l + 1, uv, t, n);
+    return n;
+}
+
+void NormalMap::bilinear(int l, const vec2 &uv, double weight, vec3 &n) const
+{
+    const Level &level = levels_[l];
+    BilinearTaps b = bilinearTaps(uv, level.width, level.height);
+    const float *p00 = texel(level, b.x0, b.y0);
+    const float *p10 = texel(level, b.x1, b.y0);
+    const float *p01 = texel(level, b.x0, b.y1);
+    const float *p11 = texel(level, b.x1, b.y1);
+    for (int c = 0; c < 3; c++)
+    {
+        double top = p00[c] + (p10[c] - p00[c]) * b.tu;
+        double bottom = p01[c] + (p11[c] - p01[c]) * b.tu;
+        n[c] += weight * (top + (bottom - top) * b.tv);
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+#include "geometry.hpp"
+#include "tgaimage.hpp"
+
+enum class TextureFilter
+{
+    // Closest texel of the full resolution image
+    NEAREST,
+    // Bilinear filtering of the closest mip level
+    BILINEAR,
+    // Bilinear filtering of the two closest mip levels, blended
+    TRILINEAR
+};
+
+// Order of the texels in memory
+enum class TextureLayout
+{
+    // Rows one after the other, like TGAImage
+    ROW_MAJOR,
+    // 8x8 blocks of texels one after the other in row-major order, texels in
+    // Morton (Z) order within a block: texels close in both directions share
+    // cache lines. Sizes are padded to a multiple of 8
+    MORTON
+};
+
+const int MORTON_BLOCK = 8;
+
+// Number of texels a width x height image takes in the layout
+inline size_t layoutSize(TextureLayout layout, int width, int height)
+{
+    if (layout == TextureLayout::ROW_MAJOR)
+        return (size_t)width * height;
+    size_t blocksX = (width + MORTON_BLOCK - 1) / MORTON_BLOCK;
+    size_t blocksY = (height + MORTON_BLOCK - 1) / MORTON_BLOCK;
+    return blocksX * blocksY * MORTON_BLOCK * MORTON_BLOCK;
+}
+
+// Index of texel (x, y) of a width wide image stored in the layout
+inline size_t texelIndex(TextureLayout layout, int width, int x, int y)
+{
+    if (layout == TextureLayout::ROW_MAJOR)
+        return x + (size_t)y * width;
+    // Bits of a 3-bit coordinate spread to the even positions
+    static const unsigned char spread[MORTON_BLOCK] = {0, 1, 4, 5, 16, 17, 20, 21};
+    unsigned ux = x, uy = y;
+    size_t blocksX = (width + MORTON_BLOCK - 1) / MORTON_BLOCK;
+    size_t block = (ux / MORTON_BLOCK) + (uy / MORTON_BLOCK) * blocksX;
+    return block * MORTON_BLOCK * MORTON_BLOCK + (spread[ux % MORTON_BLOCK] | spread[uy % MORTON_BLOCK] << 1);
+}
+
+// Image with its mip chain: every level halves the previous one with a box
+// filter, down to 1x1. Texture coordinates are in [0, 1], clamped at the edges
+class Texture
+{
+public:
+    Texture();
+    explicit Texture(const TGAImage &image);
+
+    // Reads the image flipped vertically, so that v goes up
+    bool read_tga_file(const std::string &filename);
+
+    // Reorders the texels of every level
+    void set_layout(TextureLayout layout);
+    TextureLayout layout() const;
+
+    int levels() const;
+    int get_width(int level = 0) const;
+    int get_height(int level = 0) const;
+    int get_bytespp() const;
+    // Texels of a level in the order of the layout, NULL for a missing image
+    const unsigned char *data(int level = 0) const;
+    // Texel of a level, TGAColor() outside the image like TGAImage::get
+    TGAColor get(int level, int x, int y) const;
+
+    // Level of detail of a triangle covering screenArea pixels and uvArea in
+    // texture coordinates: log2 of the number of texels per pixel side
+    double lod(double uvArea, double screenArea) const;
+
+    // Closest texel of the full resolution image
+    TGAColor sample(const vec2 &uv) const;
+    TGAColor sample(const vec2 &uv, double lod, TextureFilter filter) const;
+
+private:
+    struct Level
+    {
+        int width = 0;
+        int height = 0;
+        std::vector<unsigned char> data;
+    };
+    std::vector<Level> levels_;
+    int bytespp_ = 0;
+    TextureLayout layout_ = TextureLayout::ROW_MAJOR;
+
+    const unsigned char *texel(const Level &level, int x, int y) const;
+    void build_mipmaps();
+    // Adds weight times the bilinear sample of the level to color
+    void bilinear(int level, const vec2 &uv, double weight, double *color) const;
+};
+
+// Normal map decoded once from the bytes of its image, for every level of the
+// mip chain: 3 floats (x, y, z) in [-1, 1] per texel
+class NormalMap
+{
+public:
+    NormalMap();
+    explicit NormalMap(const Texture &texture);
+
+    bool read_tga_file(const std::string &filename);
+
+    void set_layout(TextureLayout layout);
+    TextureLayout layout() const;
+
+    int levels() const;
+    // Packed texels of a level in the order of the layout, NULL for a missing map
+    const float *data(int level = 0) const;
+    int get_width() const;
+    int get_height() const;
+
+    double lod(double uvArea, double screenArea) const;
+
+    // Closest texel of the full resolution map
+    vec3 sample(const vec2 &uv) const;
+    vec3 sample(const vec2 &uv, double lod, TextureFilter filter) const;
+
+private:
+    struct Level
+    {
+        int width = 0;
+        int height = 0;
+        std::vector<float> data;
+    };
+    std::vector<Level> levels_;
+    TextureLayout layout_ = TextureLayout::ROW_MAJOR;
+
+    const float *texel(const Level &level, int x, int y) const;
+    // Adds weight times the bilinear sample of the level to n
+    void bilinear(int level, const vec2 &uv, double weight, vec3 &n) const;
+};
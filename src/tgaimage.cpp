@@ -1,8 +1,13 @@
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <algorithm>
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "tgaimage.hpp"
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0)
@@ -53,55 +58,81 @@ bool TGAImage::read_tga_file(const char *filename)
     if (data)
         delete[] data;
     data = NULL;
+    // The whole file is read at once and decoded from memory
     std::ifstream in;
-    in.open(filename, std::ios::binary);
+    in.open(filename, std::ios::binary | std::ios::ate);
     if (!in.is_open())
     {
         std::cerr << "can't open file " << filename << "\n";
         in.close();
         return false;
     }
-    TGA_Header header;
-    in.read((char *)&header, sizeof(header));
+    std::vector<unsigned char> bytes(in.tellg());
+    in.seekg(0);
+    in.read((char *)bytes.data(), bytes.size());
     if (!in.good())
     {
         in.close();
+        std::cerr << "an error occured while reading the file\n";
+        return false;
+    }
+    in.close();
+    return read_tga(bytes.data(), bytes.size());
+}
+
+bool TGAImage::read_tga(const unsigned char *bytes, size_t size)
+{
+    if (data)
+        delete[] data;
+    data = NULL;
+    TGA_Header header;
+    if (size < sizeof(header))
+    {
         std::cerr << "an error occured while reading the header\n";
         return false;
     }
+    memcpy(&header, bytes, sizeof(header));
     width = header.width;
     height = header.height;
     bytespp = header.bitsperpixel >> 3;
     if (width <= 0 || height <= 0 || (bytespp != GRAYSCALE && bytespp != RGB && bytespp != RGBA))
     {
-        in.close();
         std::cerr << "bad bpp (or width/height) value\n";
         return false;
     }
-    unsigned long nbytes = bytespp * width * height;
+    // Pixels follow the image id and the unused color map
+    size_t offset = sizeof(header) + (unsigned char)header.idlength;
+    if (header.colormaptype)
+        offset += header.colormaplength * (((unsigned char)header.colormapdepth + 7) >> 3);
+    if (offset > size)
+    {
+        std::cerr << "an error occured while reading the header\n";
+        return false;
+    }
+    bytes += offset;
+    size -= offset;
+
+    size_t nbytes = (size_t)bytespp * width * height;
     data = new unsigned char[nbytes];
     if (3 == header.datatypecode || 2 == header.datatypecode)
     {
-        in.read((char *)data, nbytes);
-        if (!in.good())
+        if (size < nbytes)
         {
-            in.close();
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
+        memcpy(data, bytes, nbytes);
     }
     else if (10 == header.datatypecode || 11 == header.datatypecode)
     {
-        if (!load_rle_data(in))
+        if (!load_rle_data(bytes, size))
         {
-            in.close();
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
     }
     else
     {
-        in.close();
         std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
         return false;
     }
@@ -113,133 +144,147 @@ bool TGAImage::read_tga_file(const char *filename)
     {
         flip_horizontally();
     }
-    // std::cerr << width << "x" << height << "/" << bytespp * 8 << "\n";
-    in.close();
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in)
+namespace
 {
-    unsigned long pixelcount = width * height;
-    unsigned long currentpixel = 0;
-    unsigned long currentbyte = 0;
-    TGAColor colorbuffer;
-    do
+    // Fills count pixels with the first one, already at out: the filled part
+    // is copied after itself, doubling every time
+    void fill_pixels(unsigned char *out, size_t count, int bytespp)
     {
-        unsigned char chunkheader = 0;
-        chunkheader = in.get();
-        if (!in.good())
+        size_t total = count * bytespp;
+        if (bytespp == 1)
         {
-            std::cerr << "an error occured while reading the data\n";
-            return false;
+            memset(out + 1, out[0], total - 1);
+            return;
         }
-        if (chunkheader < 128)
+        size_t filled = bytespp;
+        while (filled < total)
         {
-            chunkheader++;
-            for (int i = 0; i < chunkheader; i++)
-            {
-                in.read((char *)colorbuffer.raw, bytespp);
-                if (!in.good())
-                {
-                    std::cerr << "an error occured while reading the header\n";
-                    return false;
-                }
-                for (int t = 0; t < bytespp; t++)
-                    data[currentbyte++] = colorbuffer.raw[t];
-                currentpixel++;
-                if (currentpixel > pixelcount)
-                {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
-            }
+            size_t n = std::min(filled, total - filled);
+            memcpy(out + filled, out, n);
+            filled += n;
         }
-        else
+    }
+
+    // Number of bytes a and b have in common from the start, up to n,
+    // compared 16 at a time
+    size_t common_bytes(const unsigned char *a, const unsigned char *b, size_t n)
+    {
+        size_t i = 0;
+#ifdef __SSE2__
+        for (; i + 16 <= n; i += 16)
         {
-            chunkheader -= 127;
-            in.read((char *)colorbuffer.raw, bytespp);
-            if (!in.good())
-            {
-                std::cerr << "an error occured while reading the header\n";
+            __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+            unsigned differ = ~_mm_movemask_epi8(eq) & 0xffff;
+            if (differ)
+                return i + __builtin_ctz(differ);
+        }
+#endif
+        while (i < n && a[i] == b[i])
+            i++;
+        return i;
+    }
+
+    inline bool same_pixel(const unsigned char *a, const unsigned char *b, int bytespp)
+    {
+        for (int t = 0; t < bytespp; t++)
+        {
+            if (a[t] != b[t])
                 return false;
+        }
+        return true;
+    }
+
+    // RLE packets of the pixels [begin, end), which they never cross
+    // TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
+    void encode_rle(const unsigned char *data, int bytespp, size_t begin, size_t end, std::vector<unsigned char> &out)
+    {
+        const size_t max_chunk_length = 128;
+        size_t curpix = begin;
+        while (curpix < end)
+        {
+            const unsigned char *chunk = data + curpix * bytespp;
+            size_t left = std::min(max_chunk_length, end - curpix);
+            if (left > 1 && same_pixel(chunk, chunk + bytespp, bytespp))
+            {
+                // Run: the pixel repeats until the first byte that differs
+                // from the same byte of the next pixel
+                size_t run_length = 1 + common_bytes(chunk, chunk + bytespp, (left - 1) * bytespp) / bytespp;
+                out.push_back(run_length + 127);
+                out.insert(out.end(), chunk, chunk + bytespp);
+                curpix += run_length;
+                continue;
             }
-            for (int i = 0; i < chunkheader; i++)
+            // Raw: up to the first pixel starting a run
+            size_t run_length = 1;
+            while (run_length < left)
             {
-                for (int t = 0; t < bytespp; t++)
-                    data[currentbyte++] = colorbuffer.raw[t];
-                currentpixel++;
-                if (currentpixel > pixelcount)
+                if (run_length > 1 && same_pixel(chunk + (run_length - 1) * bytespp, chunk + run_length * bytespp, bytespp))
                 {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
+                    run_length--;
+                    break;
                 }
+                run_length++;
             }
+            out.push_back(run_length - 1);
+            out.insert(out.end(), chunk, chunk + run_length * bytespp);
+            curpix += run_length;
         }
-    } while (currentpixel < pixelcount);
-    return true;
+    }
 }
 
-bool TGAImage::write_tga_file(const char *filename, bool rle)
+bool TGAImage::load_rle_data(const unsigned char *in, size_t size)
 {
-    unsigned char developer_area_ref[4] = {0, 0, 0, 0};
-    unsigned char extension_area_ref[4] = {0, 0, 0, 0};
-    unsigned char footer[18] = {'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O', 'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
-    std::ofstream out;
-    out.open(filename, std::ios::binary);
-    if (!out.is_open())
-    {
-        std::cerr << "can't open file " << filename << "\n";
-        out.close();
-        return false;
-    }
-    TGA_Header header;
-    memset((void *)&header, 0, sizeof(header));
-    header.bitsperpixel = bytespp << 3;
-    header.width = width;
-    header.height = height;
-    header.datatypecode = (bytespp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
-    header.imagedescriptor = 0x20; // top-left origin
-    out.write((char *)&header, sizeof(header));
-    if (!out.good())
-    {
-        out.close();
-        std::cerr << "can't dump the tga file\n";
-        return false;
-    }
-    if (!rle)
+    size_t pixelcount = (size_t)width * height;
+    size_t currentpixel = 0;
+    size_t pos = 0;
+    unsigned char *out = data;
+    while (currentpixel < pixelcount)
     {
-        out.write((char *)data, width * height * bytespp);
-        if (!out.good())
+        if (pos >= size)
         {
-            std::cerr << "can't unload raw data\n";
-            out.close();
+            std::cerr << "an error occured while reading the data\n";
             return false;
         }
-    }
-    else
-    {
-        if (!unload_rle_data(out))
+        unsigned char chunkheader = in[pos++];
+        size_t count = (chunkheader & 127) + 1;
+        if (currentpixel + count > pixelcount)
         {
-            out.close();
-            std::cerr << "can't unload rle data\n";
+            std::cerr << "Too many pixels read\n";
             return false;
         }
+        // Raw packets are copied at once, runs are filled from their pixel
+        size_t nbytes = chunkheader < 128 ? count * bytespp : bytespp;
+        if (pos + nbytes > size)
+        {
+            std::cerr << "an error occured while reading the data\n";
+            return false;
+        }
+        memcpy(out, in + pos, nbytes);
+        if (chunkheader >= 128)
+            fill_pixels(out, count, bytespp);
+        pos += nbytes;
+        out += count * bytespp;
+        currentpixel += count;
     }
-    out.write((char *)developer_area_ref, sizeof(developer_area_ref));
-    if (!out.good())
-    {
-        std::cerr << "can't dump the tga file\n";
-        out.close();
-        return false;
-    }
-    out.write((char *)extension_area_ref, sizeof(extension_area_ref));
-    if (!out.good())
+    return true;
+}
+
+bool TGAImage::write_tga_file(const char *filename, bool rle)
+{
+    std::vector<unsigned char> bytes;
+    write_tga(bytes, rle);
+    std::ofstream out;
+    out.open(filename, std::ios::binary);
+    if (!out.is_open())
     {
-        std::cerr << "can't dump the tga file\n";
+        std::cerr << "can't open file " << filename << "\n";
         out.close();
         return false;
     }
-    out.write((char *)footer, sizeof(footer));
+    out.write((const char *)bytes.data(), bytes.size());
     if (!out.good())
     {
         std::cerr << "can't dump the tga file\n";
@@ -250,59 +295,51 @@ bool TGAImage::write_tga_file(const char *filename, bool rle)
     return true;
 }
 
-// TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out)
+void TGAImage::write_tga(std::vector<unsigned char> &bytes, bool rle) const
 {
-    const unsigned char max_chunk_length = 128;
-    unsigned long npixels = width * height;
-    unsigned long curpix = 0;
-    while (curpix < npixels)
+    unsigned char developer_area_ref[4] = {0, 0, 0, 0};
+    unsigned char extension_area_ref[4] = {0, 0, 0, 0};
+    unsigned char footer[18] = {'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O', 'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
+    TGA_Header header;
+    memset((void *)&header, 0, sizeof(header));
+    header.bitsperpixel = bytespp << 3;
+    header.width = width;
+    header.height = height;
+    header.datatypecode = (bytespp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
+    header.imagedescriptor = 0x20; // top-left origin
+    bytes.assign((unsigned char *)&header, (unsigned char *)&header + sizeof(header));
+    if (!rle)
+        bytes.insert(bytes.end(), data, data + (size_t)width * height * bytespp);
+    else
+        unload_rle_data(bytes);
+    bytes.insert(bytes.end(), developer_area_ref, developer_area_ref + sizeof(developer_area_ref));
+    bytes.insert(bytes.end(), extension_area_ref, extension_area_ref + sizeof(extension_area_ref));
+    bytes.insert(bytes.end(), footer, footer + sizeof(footer));
+}
+
+void TGAImage::unload_rle_data(std::vector<unsigned char> &out) const
+{
+    // Bands of scanlines are encoded in parallel and their packets appended
+    // in order. Packets never cross bands, whose height does not depend on
+    // the number of threads, so the file does not either
+    const int band_height = 16;
+    int nbands = (height + band_height - 1) / band_height;
+    std::vector<std::vector<unsigned char>> bands(nbands);
+#pragma omp parallel for schedule(dynamic, 1) if (nbands > 1)
+    for (int b = 0; b < nbands; b++)
     {
-        unsigned long chunkstart = curpix * bytespp;
-        unsigned long curbyte = curpix * bytespp;
-        unsigned char run_length = 1;
-        bool raw = true;
-        while (curpix + run_length < npixels && run_length < max_chunk_length)
-        {
-            bool succ_eq = true;
-            for (int t = 0; succ_eq && t < bytespp; t++)
-            {
-                succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
-            }
-            curbyte += bytespp;
-            if (1 == run_length)
-            {
-                raw = !succ_eq;
-            }
-            if (raw && succ_eq)
-            {
-                run_length--;
-                break;
-            }
-            if (!raw && !succ_eq)
-            {
-                break;
-            }
-            run_length++;
-        }
-        curpix += run_length;
-        out.put(raw ? run_length - 1 : run_length + 127);
-        if (!out.good())
-        {
-            std::cerr << "can't dump the tga file\n";
-            return false;
-        }
-        out.write((char *)(data + chunkstart), (raw ? run_length * bytespp : bytespp));
-        if (!out.good())
-        {
-            std::cerr << "can't dump the tga file\n";
-            return false;
-        }
+        size_t begin = (size_t)b * band_height * width;
+        size_t end = (size_t)std::min((b + 1) * band_height, height) * width;
+        bands[b].reserve((end - begin) * bytespp / 2);
+        encode_rle(data, bytespp, begin, end, bands[b]);
+    }
+    for (const std::vector<unsigned char> &band : bands)
+    {
+        out.insert(out.end(), band.begin(), band.end());
     }
-    return true;
 }
 
-TGAColor TGAImage::get(int x, int y)
+TGAColor TGAImage::get(int x, int y) const
 {
     if (!data || x < 0 || y < 0 || x >= width || y >= height)
     {
@@ -324,17 +361,17 @@ bool TGAImage::set(int x, int y, TGAColor c)
     return true;
 }
 
-int TGAImage::get_bytespp()
+int TGAImage::get_bytespp() const
 {
     return bytespp;
 }
 
-int TGAImage::get_width()
+int TGAImage::get_width() const
 {
     return width;
 }
 
-int TGAImage::get_height()
+int TGAImage::get_height() const
 {
     return height;
 }
@@ -381,6 +418,11 @@ unsigned char *TGAImage::buffer()
     return data;
 }
 
+const unsigned char *TGAImage::buffer() const
+{
+    return data;
+}
+
 void TGAImage::clear()
 {
     memset((void *)data, 0, width * height * bytespp);
@@ -1,6 +1,11 @@
 #pragma once
 
 #include <fstream>
+#include <vector>
+#include <span>
+#include <cstddef>
+#include <cassert>
+#include <string.h>
 
 #pragma pack(push, 1)
 struct TGA_Header
@@ -20,6 +25,9 @@ struct TGA_Header
 };
 #pragma pack(pop)
 
+// Color of a pixel, bytes in the order of the file: blue, green, red and
+// alpha. Formats with fewer bytes per pixel only use the first ones and leave
+// the others at 0
 struct TGAColor
 {
     union
@@ -31,35 +39,108 @@ struct TGAColor
         unsigned char raw[4];
         unsigned int val;
     };
-    int bytespp;
-
-    TGAColor() : val(0), bytespp(1) {}
 
-    TGAColor(unsigned char R, unsigned char G, unsigned char B, unsigned char A) : b(B), g(G), r(R), a(A), bytespp(4) {}
+    TGAColor() : val(0) {}
 
-    TGAColor(int v, int bpp) : val(v), bytespp(bpp) {}
+    TGAColor(unsigned char R, unsigned char G, unsigned char B, unsigned char A) : b(B), g(G), r(R), a(A) {}
 
-    TGAColor(const TGAColor &c) : val(c.val), bytespp(c.bytespp) {}
+    TGAColor(const TGAColor &c) : val(c.val) {}
 
-    TGAColor(const unsigned char *p, int bpp) : val(0), bytespp(bpp)
+    TGAColor(const unsigned char *p, int bpp) : val(0)
     {
-        for (int i = 0; i < bpp; i++)
+        switch (bpp)
         {
-            raw[i] = p[i];
+        case 1:
+            raw[0] = p[0];
+            break;
+        case 3:
+            memcpy(raw, p, 3);
+            break;
+        case 4:
+            memcpy(raw, p, 4);
+            break;
+        default:
+            for (int i = 0; i < bpp; i++)
+            {
+                raw[i] = p[i];
+            }
         }
     }
 
     TGAColor &operator=(const TGAColor &c)
     {
-        if (this != &c)
-        {
-            bytespp = c.bytespp;
-            val = c.val;
-        }
+        val = c.val;
         return *this;
     }
 };
 
+static_assert(sizeof(TGAColor) == 4, "TGAColor fits in a register");
+
+// Pixel of an image whose number of bytes per pixel is known at compile time
+template <int bytespp>
+struct TGAPixel
+{
+    unsigned char raw[bytespp];
+
+    TGAPixel &operator=(const TGAColor &c)
+    {
+        memcpy(raw, c.raw, bytespp);
+        return *this;
+    }
+
+    operator TGAColor() const
+    {
+        TGAColor c;
+        memcpy(c.raw, raw, bytespp);
+        return c;
+    }
+};
+
+// Direct access to the pixels of an image, without the checks of
+// TGAImage::get and TGAImage::set: coordinates are only checked by debug
+// builds. Pixel is TGAPixel<bytespp>, const for a read-only view
+template <typename Pixel>
+class TGAView
+{
+public:
+    TGAView() {}
+    TGAView(Pixel *pixels, int width, int height) : pixels_(pixels), width_(width), height_(height) {}
+
+    int get_width() const
+    {
+        return width_;
+    }
+
+    int get_height() const
+    {
+        return height_;
+    }
+
+    std::span<Pixel> row(int y) const
+    {
+        assert(y >= 0 && y < height_);
+        return std::span<Pixel>(pixels_ + (size_t)y * width_, width_);
+    }
+
+    Pixel &operator()(int x, int y) const
+    {
+        assert(x >= 0 && y >= 0 && x < width_ && y < height_);
+        return pixels_[x + (size_t)y * width_];
+    }
+
+    // Pixel at an index of the buffer, for pixels not ordered by rows
+    Pixel &operator[](size_t i) const
+    {
+        assert(i < (size_t)width_ * height_);
+        return pixels_[i];
+    }
+
+private:
+    Pixel *pixels_ = NULL;
+    int width_ = 0;
+    int height_ = 0;
+};
+
 class TGAImage
 {
 protected:
@@ -68,8 +149,8 @@ protected:
     int height;
     int bytespp;
 
-    bool load_rle_data(std::ifstream &in);
-    bool unload_rle_data(std::ofstream &out);
+    bool load_rle_data(const unsigned char *in, size_t size);
+    void unload_rle_data(std::vector<unsigned char> &out) const;
 
 public:
     enum Format
@@ -84,16 +165,36 @@ public:
     TGAImage(const TGAImage &img);
     bool read_tga_file(const char *filename);
     bool write_tga_file(const char *filename, bool rle = true);
+    // Decodes a whole TGA file already in memory
+    bool read_tga(const unsigned char *bytes, size_t size);
+    // Encodes the image as a whole TGA file, RLE packets are built in parallel
+    void write_tga(std::vector<unsigned char> &bytes, bool rle = true) const;
     bool flip_horizontally();
     bool flip_vertically();
     bool scale(int w, int h);
-    TGAColor get(int x, int y);
+    TGAColor get(int x, int y) const;
     bool set(int x, int y, TGAColor c);
     ~TGAImage();
     TGAImage &operator=(const TGAImage &img);
-    int get_width();
-    int get_height();
-    int get_bytespp();
+    int get_width() const;
+    int get_height() const;
+    int get_bytespp() const;
     unsigned char *buffer();
+    const unsigned char *buffer() const;
+
+    // Typed access to the pixels, the image must have bytespp bytes per pixel
+    template <int bytespp>
+    TGAView<TGAPixel<bytespp>> view()
+    {
+        assert(this->bytespp == bytespp && data);
+        return TGAView<TGAPixel<bytespp>>((TGAPixel<bytespp> *)data, width, height);
+    }
+
+    template <int bytespp>
+    TGAView<const TGAPixel<bytespp>> view() const
+    {
+        assert(this->bytespp == bytespp && data);
+        return TGAView<const TGAPixel<bytespp>>((const TGAPixel<bytespp> *)data, width, height);
+    }
     void clear();
 };
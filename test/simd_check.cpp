@@ -0,0 +1,95 @@
+// Checks that the AVX2 path of RenderMode::FULL matches the scalar path: the
+// african head is rendered with Engine::simd off and on, at every 15 degrees
+// and in every depth format and frame layout the AVX2 path draws, and no
+// channel may differ by more than 1.
+//
+// usage: simd_check
+//
+// Exits with 77 (skipped by ctest) on CPUs without AVX2.
+
+#include <iostream>
+#include <cstdlib>
+#include <memory>
+
+#include "engine.hpp"
+
+namespace
+{
+    const int SIZE = 400;
+    const int SKIPPED = 77;
+
+    struct Config
+    {
+        const char *name;
+        DepthFormat format;
+        bool reversed;
+        FrameLayout layout;
+    };
+
+    const Config CONFIGS[] = {
+        {"float64", DepthFormat::FLOAT64, false, FrameLayout::LINEAR},
+        {"float32", DepthFormat::FLOAT32, false, FrameLayout::LINEAR},
+        {"float32 reversed", DepthFormat::FLOAT32, true, FrameLayout::LINEAR},
+        {"float64 tiled", DepthFormat::FLOAT64, false, FrameLayout::TILED},
+    };
+
+    TGAImage render(const Scene &scene, const Config &config, int angle, bool simd)
+    {
+        Camera camera(vec3(0, 0, 2.1), vec3(0, 0, 0), 90, 0.1, 1000);
+        Engine engine(SIZE, SIZE, camera);
+        engine.scene = scene;
+        engine.setDepthFormat(config.format, config.reversed);
+        engine.setFrameLayout(config.layout);
+        engine.setLight(vec3(0, 0, 1));
+        engine.M = rotate(vec3(0, angle, 0));
+        engine.simd = simd;
+        engine.draw(RenderMode::FULL);
+        engine.resolve();
+        return engine.frameBuffer;
+    }
+}
+
+int main()
+{
+    if (!cpuHasAVX2())
+    {
+        std::cout << "no AVX2, skipped\n";
+        return SKIPPED;
+    }
+
+    auto material = std::make_shared<Material>();
+    material->set_diffusemap("obj/african_head/african_head_diffuse.tga");
+    material->set_normalmap("obj/african_head/african_head_nm.tga");
+    material->set_specularmap("obj/african_head/african_head_spec.tga");
+    Scene scene;
+    scene.add(std::make_shared<Model>("obj/african_head/african_head.obj", false), material);
+
+    bool ok = true;
+    for (const Config &config : CONFIGS)
+    {
+        long differing = 0;
+        int worst = 0;
+        for (int angle = 0; angle < 360; angle += 15)
+        {
+            TGAImage scalar = render(scene, config, angle, false);
+            TGAImage simd = render(scene, config, angle, true);
+            for (int y = 0; y < SIZE; y++)
+            {
+                for (int x = 0; x < SIZE; x++)
+                {
+                    TGAColor a = scalar.get(x, y);
+                    TGAColor b = simd.get(x, y);
+                    for (int c = 0; c < 3; c++)
+                    {
+                        int d = std::abs(a.raw[c] - b.raw[c]);
+                        differing += d > 0;
+                        worst = std::max(worst, d);
+                    }
+                }
+            }
+        }
+        std::cout << config.name << ": " << differing << " channels differing, max " << worst << "\n";
+        ok = ok && worst <= 1;
+    }
+    return ok ? 0 : 1;
+}